@@ -0,0 +1,84 @@
+/*
+ * bench.h
+ *
+ * Utilidades del modo benchmark (-b) compartidas por tsqueue.c,
+ * producer_consumer.c y dining_philosophers.c: reloj monotónico en
+ * nanosegundos, lista de cantidades de hilos a barrer (-t 1,2,4,8) y
+ * salida CSV con throughput y percentiles de latencia.
+ *
+ * Columnas CSV:
+ *   program,variant,producers,consumers,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns
+ * En dining_philosophers "producers" es el número de filósofos, "consumers"
+ * vale 0 y la latencia es la espera por los tenedores.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MAX_RUNS 32
+
+// Reloj monotónico en nanosegundos; es también el reloj de log.h,
+// spinwait.h y workload.h
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Lee una lista "1,2,4,8" de cantidades de hilos; devuelve cuántas leyó
+// (0 si alguna no es un entero positivo)
+static inline int bench_parse_list(const char *arg, int *out, int max) {
+    int n = 0;
+    while (*arg != '\0' && n < max) {
+        char *end;
+        long value = strtol(arg, &end, 10);
+        if (end == arg || value <= 0 || (*end != ',' && *end != '\0')) {
+            return 0;
+        }
+        out[n++] = (int)value;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+static inline int bench_compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentil p (0..1) por rango más cercano sobre un arreglo ordenado
+static inline uint64_t bench_percentile(const uint64_t *sorted, long n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    long rank = (long)(p * n + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    return sorted[(rank > n ? n : rank) - 1];
+}
+
+static inline void bench_csv_header(void) {
+    printf("program,variant,producers,consumers,ops,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+}
+
+// Ordena las latencias (en el mismo arreglo) y escribe una fila CSV
+static inline void bench_csv_row(const char *program, const char *variant,
+                                 int producers, int consumers, long ops,
+                                 double seconds, uint64_t *latencies, long n) {
+    qsort(latencies, n, sizeof(uint64_t), bench_compare_u64);
+    printf("%s,%s,%d,%d,%ld,%.6f,%.0f,%llu,%llu,%llu\n",
+           program, variant, producers, consumers, ops, seconds, ops / seconds,
+           (unsigned long long)bench_percentile(latencies, n, 0.50),
+           (unsigned long long)bench_percentile(latencies, n, 0.99),
+           (unsigned long long)bench_percentile(latencies, n, 0.999));
+    fflush(stdout);
+}
+
+#endif
@@ -5,24 +5,187 @@
  * Se asegura que no haya deadlock usando un semáforo “camarero” que solo
  * permita a N-1 filósofos intentar tomar tenedores simultáneamente.
  *
- * Compilar: gcc dining_philosophers.c -o dining_philosophers -pthread -lrt
- * Uso: ./dining_philosophers <num_philosophers> <num_ciclos_por_filosofo>
+ * Con -a order no hay camarero: alcanza con que todos tomen los tenedores
+ * en orden de índice (jerarquía de recursos) para que no haya un ciclo de
+ * esperas, y así se puede medir cuánto cuesta el semáforo global.
+ *
+ * Con -a trylock tampoco hay camarero: el filósofo toma un tenedor y prueba
+ * el otro con pthread_mutex_trylock(); si está ocupado suelta el primero
+ * (que así queda libre para el vecino) y reintenta tras una espera
+ * aleatoria que crece con los fallos. Como nadie espera con un tenedor en
+ * la mano, no hay deadlock.
+ *
+ * Al terminar cada corrida se informa la utilización de los tenedores:
+ * qué fracción del tiempo estuvieron tomados, cuánto de eso fue comiendo
+ * (el resto es un tenedor retenido mientras se espera el otro) y, con
+ * trylock, cuántos reintentos hubo. Con -b va a stderr, para no mezclarse
+ * con el CSV.
+ *
+ * También se informa la equidad entre filósofos: la espera media y la
+ * máxima para tener ambos tenedores (y quién sufrió la máxima), el rango
+ * de comidas/s de cada filósofo y el índice de Jain sobre esos ritmos
+ * (1 = todos comen igual; cerca de 1/N = uno acapara la mesa). Cada
+ * filósofo, al terminar, también informa su espera media y máxima.
+ *
+ * Con -a cm se usa en cambio el protocolo de Chandy y Misra, sin camarero:
+ * cada tenedor es de uno de sus dos vecinos y está limpio o sucio. Al
+ * empezar cada tenedor es sucio y del vecino de menor id (así el grafo de
+ * precedencias es acíclico y no hay deadlock). Un filósofo con hambre pide
+ * los tenedores que le faltan; quien tiene un tenedor sucio y no está
+ * comiendo lo entrega limpio, y uno limpio se queda hasta después de comer.
+ * Al terminar de comer sus tenedores quedan sucios y entrega los que le
+ * pidieron. Solo se coordinan vecinos, así que nada es global a la mesa.
+ *
+ * Con -a pool los filósofos dejan de ser hilos: cada uno es una tarea en
+ * el heap (una máquina de estados pensando/con hambre) y -w hilos (por
+ * omisión, uno por CPU) las corren desde una cola de tareas listas. Los
+ * tenedores se piden en orden de índice como con -a order, pero nadie se
+ * bloquea en uno: si está ocupado la tarea se anota en el tenedor y suelta
+ * el hilo, y quien lo deja se lo pasa y la vuelve a encolar. Así la mesa
+ * puede tener 100000 filósofos sin 100000 hilos del kernel. Con sleep: un
+ * filósofo que piensa o come ocupa su hilo mientras duerme, así que para
+ * mesas grandes conviene -T/-E spin: o none.
+ *
+ * Compilar: gcc dining_philosophers.c -o dining_philosophers -pthread -lrt -lm
+ * Uso: ./dining_philosophers [-b] [-t filosofos,...] [-v nivel] [-s pausas] [-S semilla] [-T carga] [-E carga] [-a waiter|order|trylock|cm|pool] [-w hilos] <num_philosophers> <num_ciclos_por_filosofo>
+ *
+ * -b activa el modo benchmark: sin log ni demoras, imprime en CSV (ver
+ * bench.h) comidas/s y los percentiles p50/p99/p999 de la espera desde que
+ * un filósofo pide permiso al camarero (o empieza a pedir tenedores) hasta
+ * que tiene ambos;
+ * -t 5,50,500 repite la corrida con esas cantidades de filósofos.
+ *
+ * -T y -E describen cuánto piensa y cuánto come cada filósofo con el
+ * modelo de carga de workload.h (p. ej. "spin:exp:5us"); por omisión el
+ * demo duerme 200-400 ms y 250-500 ms y el benchmark no demora nada.
+ *
+ * Los mensajes pasan por el log asíncrono de log.h; -v 0|1|2 elige el nivel
+ * (2, un mensaje por evento, es el valor por omisión).
+ *
+ * Tomar un tenedor o el permiso del camarero gira un poco antes de dormir
+ * (spinwait.h), con un presupuesto que se ajusta solo; -s fija su máximo.
+ *
+ * Los tiempos aleatorios de pensar y comer salen de un generador propio
+ * de cada filósofo (rng.h) en vez de rand(), que toma un lock interno; -S
+ * fija la semilla para repetir una corrida (por omisión, la hora).
  */
 
 #include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "log.h"
+#include "rng.h"
+#include "spinwait.h"
+#include "workload.h"
+
 int num_philosophers;
 int cycles_per_philosopher;
 
-// Cada tenedor es un mutex
+// Cada tenedor es un mutex, con el ajuste de su fase de espera activa
 pthread_mutex_t *forks;
+SpinTuner *fork_spin;
 
 // Semáforo camarero (permite hasta num_philosophers-1 a la vez)
 sem_t waiter;
+SpinTuner waiter_spin;
+
+// Estrategia para tomar los tenedores, elegida al arrancar con -a
+typedef enum { TABLE_WAITER, TABLE_ORDER, TABLE_TRYLOCK, TABLE_CHANDY_MISRA, TABLE_POOL } TableStrategy;
+static TableStrategy table_strategy = TABLE_WAITER;
+static const char *const table_strategy_names[] = {"waiter", "order", "trylock", "chandy_misra", "pool"};
+
+// -a trylock: tope de la espera aleatoria tras un fallo, en pausas de CPU;
+// se duplica con cada fallo seguido
+#define TRYLOCK_BACKOFF_MIN 16
+#define TRYLOCK_BACKOFF_MAX 1024
+
+// Métricas de cada filósofo, en su propia línea de caché: uso de
+// tenedores y espera por ellos
+typedef struct {
+    _Alignas(64) uint64_t held_ns; // suma sobre sus tenedores del tiempo tomados
+    uint64_t eating_ns;            // parte de held_ns con ambos tenedores
+    long retries;                  // -a trylock: veces que soltó el primero
+    uint64_t wait_ns;              // espera total desde que pide hasta tener ambos
+    uint64_t max_wait_ns;          // la peor de esas esperas
+    long meals;                    // comidas completadas
+    uint64_t started_ns;           // cuándo empezó su primer ciclo
+    uint64_t finished_ns;          // cuándo terminó el último
+} PhilosopherStats;
+
+static PhilosopherStats *phil_stats;
+
+// Pila de cada filósofo: con miles de hilos la de omisión (8 MB) agota el
+// espacio de direcciones, y un filósofo usa muy poca
+#define PHILOSOPHER_STACK (64 * 1024)
+
+// Tenedor de Chandy-Misra (-a cm), compartido por los filósofos f y f-1.
+// Todos los campos se protegen con lock; cada tenedor en su propia línea de
+// caché porque solo lo tocan sus dos vecinos
+typedef struct {
+    _Alignas(64) pthread_mutex_t lock;
+    pthread_cond_t handed; // cambió de dueño o dejó de usarse
+    int owner;             // filósofo que lo tiene
+    int dirty;             // ya se usó para comer desde que lo recibió
+    int in_use;            // el dueño está comiendo con él
+    int requested;         // el otro vecino lo pidió y espera en handed
+} CmFork;
+
+static CmFork *cm_forks;
+
+// -a pool: los filósofos son tareas (máquinas de estados) que corren
+// pool_workers hilos, en vez de un hilo cada uno
+typedef enum { PHIL_THINKING, PHIL_HUNGRY } PhilState;
+
+typedef struct {
+    int id;
+    PhilState state;
+    int cycle;
+    int held;             // tenedores que ya tiene, en orden de índice (0, 1 o 2)
+    uint64_t requested;   // cuándo empezó a pedir tenedores
+    uint64_t granted;     // cuándo consiguió el primero
+    RngState rng;         // su generador, que viaja con la tarea de hilo en hilo
+} PhilTask;
+
+// Tenedor de -a pool. Nunca se espera en él: quien lo encuentra ocupado se
+// anota en waiting y deja libre al hilo; al soltarlo, el dueño se lo pasa
+// directamente y vuelve a encolar su tarea. Como solo lo comparten dos
+// vecinos, hay a lo sumo uno esperando
+typedef struct {
+    pthread_mutex_t lock;
+    int holder;  // filósofo que lo tiene, -1 si está libre
+    int waiting; // filósofo que espera que se lo pasen, -1 si ninguno
+} PoolFork;
+
+// Cola de tareas listas para correr: un anillo de num_philosophers ids (cada
+// tarea está encolada a lo sumo una vez)
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    SpinTuner spin;
+    int *ids;
+    int head, count;
+    int remaining; // filósofos que no terminaron; con 0 los hilos salen
+} RunQueue;
+
+static int pool_workers; // -w; por omisión, uno por CPU
+static PhilTask *pool_tasks;
+static PoolFork *pool_forks;
+static RunQueue run_queue;
+
+// Modo benchmark (-b): cada comida anota su espera por los tenedores en
+// bench_latency[id * cycles_per_philosopher + ciclo]
+static int benchmark_mode = 0;
+static uint64_t *bench_latency;
+
+// Cuánto piensa y cuánto come cada filósofo por ciclo (-T y -E)
+static Workload think_work;
+static Workload eat_work;
 
 typedef struct {
     int id;
@@ -30,14 +193,160 @@ typedef struct {
 
 // Simula pensar
 void think(int id) {
-    printf("[Filósofo %d] Pensando...\n", id);
-    usleep(200000 + (rand() % 200000)); // 200-400 ms
+    log_msg(LOG_EVENT, "[Filósofo %d] Pensando...\n", id);
+    workload_run(&think_work);
 }
 
 // Simula comer
 void eat(int id, int cycle) {
-    printf("[Filósofo %d] Comiendo (ciclo %d)...\n", id, cycle);
-    usleep(250000 + (rand() % 250000)); // 250-500 ms
+    log_msg(LOG_EVENT, "[Filósofo %d] Comiendo (ciclo %d)...\n", id, cycle);
+    workload_run(&eat_work);
+}
+
+static int waiter_ready(void *arg) {
+    (void)arg;
+    return sem_trywait(&waiter) == 0;
+}
+
+// sem_wait(&waiter) con fase de espera activa antes de dormir
+static void waiter_acquire(void) {
+    if (sem_trywait(&waiter) == 0 || spin_wait(&waiter_spin, waiter_ready, NULL)) {
+        return;
+    }
+    uint64_t parked = bench_now_ns();
+    sem_wait(&waiter);
+    spin_parked(&waiter_spin, bench_now_ns() - parked);
+}
+
+// Consigue el tenedor f para id: si el dueño lo tiene sucio y no está
+// comiendo, pasa limpio a id; si no, deja el pedido y espera a que se lo
+// entreguen
+static void cm_request(int id, CmFork *f) {
+    pthread_mutex_lock(&f->lock);
+    while (f->owner != id) {
+        if (f->dirty && !f->in_use) {
+            f->owner = id;
+            f->dirty = 0;
+            f->requested = 0;
+            break;
+        }
+        f->requested = 1;
+        pthread_cond_wait(&f->handed, &f->lock);
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+// Junta los dos tenedores de id y los marca en uso. Mientras espera uno, el
+// otro puede irse si estaba sucio: se vuelve a pedir hasta tener ambos (uno
+// limpio ya no se lo quitan, así que cada vuelta progresa)
+static void cm_acquire(int id, CmFork *first, CmFork *second) {
+    for (;;) {
+        pthread_mutex_lock(&first->lock);
+        pthread_mutex_lock(&second->lock);
+        if (first->owner == id && second->owner == id) {
+            first->in_use = second->in_use = 1;
+            pthread_mutex_unlock(&second->lock);
+            pthread_mutex_unlock(&first->lock);
+            return;
+        }
+        CmFork *missing = first->owner != id ? first : second;
+        pthread_mutex_unlock(&second->lock);
+        pthread_mutex_unlock(&first->lock);
+        cm_request(id, missing);
+    }
+}
+
+// Después de comer: el tenedor queda sucio y, si neighbor lo pidió, se le
+// entrega limpio
+static void cm_release(CmFork *f, int neighbor) {
+    pthread_mutex_lock(&f->lock);
+    f->in_use = 0;
+    f->dirty = 1;
+    if (f->requested) {
+        f->owner = neighbor;
+        f->dirty = 0;
+        f->requested = 0;
+        pthread_cond_signal(&f->handed); // solo el vecino puede estar esperando
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+// -a trylock: toma first y prueba second; si está ocupado suelta first y
+// espera un tiempo aleatorio antes de reintentar
+static void trylock_acquire(int first, int second, PhilosopherStats *stats) {
+    uint32_t backoff = TRYLOCK_BACKOFF_MIN;
+    for (;;) {
+        spin_mutex_lock(&fork_spin[first], &forks[first]);
+        uint64_t taken = bench_now_ns();
+        if (pthread_mutex_trylock(&forks[second]) == 0) {
+            stats->held_ns += bench_now_ns() - taken;
+            return;
+        }
+        pthread_mutex_unlock(&forks[first]);
+        stats->held_ns += bench_now_ns() - taken;
+        stats->retries++;
+        // Espera aleatoria para que dos vecinos no choquen otra vez al unísono
+        sched_yield();
+        for (uint32_t n = rng_below(backoff); n > 0; n--) {
+            spin_cpu_relax();
+        }
+        if (backoff < TRYLOCK_BACKOFF_MAX) {
+            backoff <<= 1;
+        }
+    }
+}
+
+// Resume la última corrida: uso de los tenedores y equidad entre
+// filósofos. Como todos hacen la misma cantidad de comidas, la equidad se
+// mide sobre el ritmo de cada uno (comidas / tiempo desde su primer ciclo
+// hasta el último, para no contar como espera lo que tardó en crearse su
+// hilo) con el índice de Jain: 1 si todos comen al mismo ritmo, 1/N si
+// come uno solo
+static void report_table(double seconds) {
+    uint64_t held = 0;
+    uint64_t eating = 0;
+    uint64_t wait = 0;
+    long retries = 0;
+    long meals = 0;
+    int worst = 0;
+    double rate_sum = 0, rate_sq = 0, rate_min = 0, rate_max = 0;
+    for (int i = 0; i < num_philosophers; i++) {
+        PhilosopherStats *st = &phil_stats[i];
+        held += st->held_ns;
+        eating += st->eating_ns;
+        wait += st->wait_ns;
+        retries += st->retries;
+        meals += st->meals;
+        if (st->max_wait_ns > phil_stats[worst].max_wait_ns) {
+            worst = i;
+        }
+        uint64_t active = st->finished_ns - st->started_ns;
+        double rate = active > 0 ? st->meals * 1e9 / active : 0;
+        rate_sum += rate;
+        rate_sq += rate * rate;
+        rate_min = i == 0 || rate < rate_min ? rate : rate_min;
+        rate_max = i == 0 || rate > rate_max ? rate : rate_max;
+    }
+    double capacity = seconds * 1e9 * num_philosophers; // ns-tenedor disponibles
+    double jain = rate_sq > 0 ? rate_sum * rate_sum / (num_philosophers * rate_sq) : 1;
+    double mean_wait = meals > 0 ? (double)wait / meals : 0;
+    if (benchmark_mode) {
+        fprintf(stderr, "# %s N=%d tenedores ocupados %.1f%% (comiendo %.1f%%), reintentos %ld\n",
+                table_strategy_names[table_strategy], num_philosophers,
+                100.0 * held / capacity, 100.0 * eating / capacity, retries);
+        fprintf(stderr, "# %s N=%d espera media %.0f ns, máxima %llu ns (filósofo %d), "
+                "comidas/s por filósofo %.0f..%.0f, Jain %.4f\n",
+                table_strategy_names[table_strategy], num_philosophers, mean_wait,
+                (unsigned long long)phil_stats[worst].max_wait_ns, worst, rate_min, rate_max, jain);
+    } else {
+        log_msg(LOG_INFO, "Tenedores ocupados %.1f%% del tiempo (comiendo %.1f%%), reintentos %ld\n",
+                100.0 * held / capacity, 100.0 * eating / capacity, retries);
+        // En mensajes separados: cada uno tiene que entrar en LOG_LINE
+        log_msg(LOG_INFO, "Espera media %.1f ms, máxima %.1f ms (filósofo %d)\n",
+                mean_wait / 1e6, phil_stats[worst].max_wait_ns / 1e6, worst);
+        log_msg(LOG_INFO, "Comidas/s por filósofo %.2f..%.2f, índice de Jain %.4f\n",
+                rate_min, rate_max, jain);
+    }
 }
 
 void *philosopher(void *arg) {
@@ -45,82 +354,503 @@ void *philosopher(void *arg) {
     int id = args->id;
     int left = id;                     // índice del tenedor izquierdo
     int right = (id + 1) % num_philosophers; // índice del tenedor derecho
+    int first = left < right ? left : right;
+    int second = left < right ? right : left;
+    PhilosopherStats *stats = &phil_stats[id];
+    rng_thread_init(id);
+    stats->started_ns = bench_now_ns();
 
     for (int i = 0; i < cycles_per_philosopher; i++) {
         think(id);
+        uint64_t requested = bench_now_ns();
 
-        // Solicitar permiso al camarero (semáforo). Solo num_philosophers-1 pueden tomar en conjunto.
-        sem_wait(&waiter);
-
-        // Tomar tenedores: primero el de menor índice (para mantener orden y evitar deadlock)
-        if (left < right) {
-            pthread_mutex_lock(&forks[left]);
-            pthread_mutex_lock(&forks[right]);
+        if (table_strategy == TABLE_CHANDY_MISRA) {
+            // Tenedor left compartido con id-1, right con id+1; se toman los
+            // locks en orden de índice
+            cm_acquire(id, &cm_forks[first], &cm_forks[second]);
+        } else if (table_strategy == TABLE_TRYLOCK) {
+            // Sin orden fijo: nadie espera con un tenedor en la mano
+            trylock_acquire(left, right, stats);
         } else {
-            pthread_mutex_lock(&forks[right]);
-            pthread_mutex_lock(&forks[left]);
+            if (table_strategy == TABLE_WAITER) {
+                // Solicitar permiso al camarero (semáforo). Solo num_philosophers-1 pueden tomar en conjunto.
+                waiter_acquire();
+            }
+
+            // Tomar tenedores: primero el de menor índice (para mantener orden y evitar deadlock)
+            spin_mutex_lock(&fork_spin[first], &forks[first]);
+            uint64_t taken = bench_now_ns();
+            spin_mutex_lock(&fork_spin[second], &forks[second]);
+            stats->held_ns += bench_now_ns() - taken; // el primero, esperando el segundo
+        }
+        uint64_t both = bench_now_ns();
+
+        uint64_t wait = both - requested;
+        stats->wait_ns += wait;
+        if (wait > stats->max_wait_ns) {
+            stats->max_wait_ns = wait;
+        }
+        stats->meals++;
+        if (benchmark_mode) {
+            bench_latency[id * cycles_per_philosopher + i] = wait;
         }
 
         // Ahora come
         eat(id, i);
 
-        // Dejar tenedores
-        pthread_mutex_unlock(&forks[left]);
-        pthread_mutex_unlock(&forks[right]);
+        uint64_t eating = 2 * (bench_now_ns() - both);
+        stats->held_ns += eating;
+        stats->eating_ns += eating;
+
+        if (table_strategy == TABLE_CHANDY_MISRA) {
+            cm_release(&cm_forks[left], (id + num_philosophers - 1) % num_philosophers);
+            cm_release(&cm_forks[right], right);
+        } else {
+            // Dejar tenedores
+            pthread_mutex_unlock(&forks[left]);
+            pthread_mutex_unlock(&forks[right]);
 
-        // Liberar espacio en el camarero
-        sem_post(&waiter);
+            if (table_strategy == TABLE_WAITER) {
+                // Liberar espacio en el camarero
+                sem_post(&waiter);
+            }
+        }
     }
 
-    printf("[Filósofo %d] Terminó todos sus ciclos.\n", id);
+    stats->finished_ns = bench_now_ns();
+    log_msg(LOG_INFO, "[Filósofo %d] Terminó todos sus ciclos (espera media %.1f ms, máxima %.1f ms).\n",
+            id, stats->meals > 0 ? stats->wait_ns / 1e6 / stats->meals : 0.0,
+            stats->max_wait_ns / 1e6);
     return NULL;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr,
-                "Uso: %s <num_philosophers> <num_ciclos_por_filosofo>\n",
-                argv[0]);
+static void run_queue_push(int id) {
+    pthread_mutex_lock(&run_queue.lock);
+    run_queue.ids[(run_queue.head + run_queue.count) % num_philosophers] = id;
+    run_queue.count++;
+    pthread_cond_signal(&run_queue.not_empty);
+    pthread_mutex_unlock(&run_queue.lock);
+}
+
+// Próxima tarea lista, esperando si no hay; -1 cuando todos terminaron
+static int run_queue_pop(void) {
+    spin_mutex_lock(&run_queue.spin, &run_queue.lock);
+    while (run_queue.count == 0 && run_queue.remaining > 0) {
+        pthread_cond_wait(&run_queue.not_empty, &run_queue.lock);
+    }
+    int id = -1;
+    if (run_queue.count > 0) {
+        id = run_queue.ids[run_queue.head];
+        run_queue.head = (run_queue.head + 1) % num_philosophers;
+        run_queue.count--;
+    }
+    pthread_mutex_unlock(&run_queue.lock);
+    return id;
+}
+
+// Toma el tenedor f para t si está libre; si no, t queda anotado para que
+// se lo pasen y devuelve 0
+static int pool_fork_take(PoolFork *f, PhilTask *t) {
+    pthread_mutex_lock(&f->lock);
+    int taken = f->holder == -1;
+    if (taken) {
+        f->holder = t->id;
+    } else {
+        f->waiting = t->id;
+    }
+    pthread_mutex_unlock(&f->lock);
+    return taken;
+}
+
+// Suelta el tenedor f: si un vecino lo espera, pasa a ser suyo y su tarea
+// vuelve a la cola
+static void pool_fork_release(PoolFork *f) {
+    pthread_mutex_lock(&f->lock);
+    int next = f->waiting;
+    f->holder = next;
+    f->waiting = -1;
+    if (next != -1) {
+        if (++pool_tasks[next].held == 1) {
+            pool_tasks[next].granted = bench_now_ns();
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+    if (next != -1) {
+        run_queue_push(next);
+    }
+}
+
+// Avanza la tarea t hasta que tenga que esperar un tenedor (la reencola
+// quien se lo pase) o termine una comida (se reencola al final, para que
+// los demás también corran). Los tenedores se piden en orden de índice, como
+// con -a order, así que tampoco hay ciclo de esperas
+static void pool_step(PhilTask *t) {
+    int id = t->id;
+    int left = id;
+    int right = (id + 1) % num_philosophers;
+    int fork_ids[2] = {left < right ? left : right, left < right ? right : left};
+    PhilosopherStats *stats = &phil_stats[id];
+
+    if (t->state == PHIL_THINKING) {
+        if (t->cycle == 0) {
+            stats->started_ns = bench_now_ns();
+        }
+        think(id);
+        t->rng = rng_state; // desde acá la tarea puede pasar a otro hilo
+        t->requested = bench_now_ns();
+        t->state = PHIL_HUNGRY;
+    }
+    while (t->held < 2) {
+        if (!pool_fork_take(&pool_forks[fork_ids[t->held]], t)) {
+            return;
+        }
+        if (++t->held == 1) {
+            t->granted = bench_now_ns();
+        }
+    }
+    uint64_t both = bench_now_ns();
+    if (both > t->granted) {
+        stats->held_ns += both - t->granted; // el primero, esperando el segundo
+    }
+
+    uint64_t wait = both - t->requested;
+    stats->wait_ns += wait;
+    if (wait > stats->max_wait_ns) {
+        stats->max_wait_ns = wait;
+    }
+    stats->meals++;
+    if (benchmark_mode) {
+        bench_latency[id * cycles_per_philosopher + t->cycle] = wait;
+    }
+
+    eat(id, t->cycle);
+    t->rng = rng_state;
+
+    uint64_t eating = 2 * (bench_now_ns() - both);
+    stats->held_ns += eating;
+    stats->eating_ns += eating;
+
+    t->held = 0;
+    t->state = PHIL_THINKING;
+    pool_fork_release(&pool_forks[left]);
+    pool_fork_release(&pool_forks[right]);
+
+    if (++t->cycle < cycles_per_philosopher) {
+        run_queue_push(id);
+        return;
+    }
+    stats->finished_ns = bench_now_ns();
+    log_msg(LOG_INFO, "[Filósofo %d] Terminó todos sus ciclos (espera media %.1f ms, máxima %.1f ms).\n",
+            id, stats->wait_ns / 1e6 / stats->meals, stats->max_wait_ns / 1e6);
+    pthread_mutex_lock(&run_queue.lock);
+    if (--run_queue.remaining == 0) {
+        pthread_cond_broadcast(&run_queue.not_empty);
+    }
+    pthread_mutex_unlock(&run_queue.lock);
+}
+
+// Hilo del pool: corre tareas de la cola hasta que todos terminen. Cada
+// tarea trae su generador (pool_step() lo guarda antes de soltarla), así
+// que sus tiempos no dependen del hilo que la corra
+static void *pool_worker(void *arg) {
+    (void)arg;
+    int id;
+    while ((id = run_queue_pop()) != -1) {
+        PhilTask *t = &pool_tasks[id];
+        rng_state = t->rng;
+        rng_seeded = 1;
+        pool_step(t);
+    }
+    return NULL;
+}
+
+// -a pool: crea las tareas y los tenedores en el heap, encola a todos los
+// filósofos pensando y corre pool_workers hilos hasta que terminen
+static void run_pool(const pthread_attr_t *attr) {
+    pool_tasks = malloc(sizeof(PhilTask) * num_philosophers);
+    pool_forks = malloc(sizeof(PoolFork) * num_philosophers);
+    run_queue.ids = malloc(sizeof(int) * num_philosophers);
+    pthread_t *workers = malloc(sizeof(pthread_t) * pool_workers);
+    if (!pool_tasks || !pool_forks || !run_queue.ids || !workers) {
+        perror("malloc pool");
         exit(EXIT_FAILURE);
     }
+    pthread_mutex_init(&run_queue.lock, NULL);
+    pthread_cond_init(&run_queue.not_empty, NULL);
+    spin_tuner_init(&run_queue.spin);
+    run_queue.head = 0;
+    run_queue.count = 0;
+    // Sin ciclos no hay nada que correr: pool_step() come antes de mirar
+    // el contador, así que ninguna tarea entra a la cola
+    run_queue.remaining = cycles_per_philosopher > 0 ? num_philosophers : 0;
+    for (int i = 0; i < num_philosophers; i++) {
+        PhilTask *t = &pool_tasks[i];
+        t->id = i;
+        t->state = PHIL_THINKING;
+        t->cycle = 0;
+        t->held = 0;
+        rng_thread_init(i);
+        t->rng = rng_state;
+        pthread_mutex_init(&pool_forks[i].lock, NULL);
+        pool_forks[i].holder = -1;
+        pool_forks[i].waiting = -1;
+        if (run_queue.remaining > 0) {
+            run_queue.ids[run_queue.count++] = i;
+        }
+    }
 
-    num_philosophers = atoi(argv[1]);
-    cycles_per_philosopher = atoi(argv[2]);
+    for (int w = 0; w < pool_workers; w++) {
+        if (pthread_create(&workers[w], attr, pool_worker, NULL) != 0) {
+            perror("pthread_create pool");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int w = 0; w < pool_workers; w++) {
+        pthread_join(workers[w], NULL);
+    }
 
-    srand(time(NULL));
+    for (int i = 0; i < num_philosophers; i++) {
+        pthread_mutex_destroy(&pool_forks[i].lock);
+    }
+    pthread_mutex_destroy(&run_queue.lock);
+    pthread_cond_destroy(&run_queue.not_empty);
+    free(run_queue.ids);
+    free(pool_forks);
+    free(pool_tasks);
+    free(workers);
+}
 
+// Sienta a num_philosophers filósofos a la mesa y espera a que terminen.
+// Devuelve los segundos transcurridos
+static double run_table(void) {
     forks = malloc(sizeof(pthread_mutex_t) * num_philosophers);
+    fork_spin = malloc(sizeof(SpinTuner) * num_philosophers);
     for (int i = 0; i < num_philosophers; i++) {
         pthread_mutex_init(&forks[i], NULL);
+        spin_tuner_init(&fork_spin[i]);
     }
+    spin_tuner_init(&waiter_spin);
 
     // Inicializar semáforo camarero a num_philosophers-1
     sem_init(&waiter, 0, num_philosophers - 1);
 
-    pthread_t phils[num_philosophers];
-    PhilosopherArgs args[num_philosophers];
-
-    // Crear hilos filósofos
-    for (int i = 0; i < num_philosophers; i++) {
-        args[i].id = i;
-        if (pthread_create(&phils[i], NULL, philosopher, &args[i]) != 0) {
-            perror("pthread_create filósofo");
+    if (table_strategy == TABLE_CHANDY_MISRA) {
+        cm_forks = aligned_alloc(64, sizeof(CmFork) * num_philosophers);
+        if (cm_forks == NULL) {
+            perror("aligned_alloc tenedores");
             exit(EXIT_FAILURE);
         }
+        for (int f = 0; f < num_philosophers; f++) {
+            // El tenedor f es de f y de f-1: empieza sucio en manos del menor
+            int prev = (f + num_philosophers - 1) % num_philosophers;
+            pthread_mutex_init(&cm_forks[f].lock, NULL);
+            pthread_cond_init(&cm_forks[f].handed, NULL);
+            cm_forks[f].owner = f < prev ? f : prev;
+            cm_forks[f].dirty = 1;
+            cm_forks[f].in_use = 0;
+            cm_forks[f].requested = 0;
+        }
     }
 
-    // Esperar a todos los filósofos
-    for (int i = 0; i < num_philosophers; i++) {
-        pthread_join(phils[i], NULL);
+    uint64_t start = bench_now_ns();
+
+    phil_stats = aligned_alloc(64, sizeof(PhilosopherStats) * num_philosophers);
+    if (phil_stats == NULL) {
+        perror("aligned_alloc métricas de filósofos");
+        exit(EXIT_FAILURE);
+    }
+    memset(phil_stats, 0, sizeof(PhilosopherStats) * num_philosophers);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PHILOSOPHER_STACK);
+
+    if (table_strategy == TABLE_POOL) {
+        run_pool(&attr);
+    } else {
+        // En el heap: con miles de filósofos no entran en la pila de main
+        pthread_t *phils = malloc(sizeof(pthread_t) * num_philosophers);
+        PhilosopherArgs *args = malloc(sizeof(PhilosopherArgs) * num_philosophers);
+        if (!phils || !args) {
+            perror("malloc filósofos");
+            exit(EXIT_FAILURE);
+        }
+
+        // Crear hilos filósofos
+        for (int i = 0; i < num_philosophers; i++) {
+            args[i].id = i;
+            if (pthread_create(&phils[i], &attr, philosopher, &args[i]) != 0) {
+                perror("pthread_create filósofo");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // Esperar a todos los filósofos
+        for (int i = 0; i < num_philosophers; i++) {
+            pthread_join(phils[i], NULL);
+        }
+        free(phils);
+        free(args);
     }
+    pthread_attr_destroy(&attr);
+    double seconds = (bench_now_ns() - start) / 1e9;
+    report_table(seconds);
+    free(phil_stats);
 
     // Destruir mutexes y semáforo
     for (int i = 0; i < num_philosophers; i++) {
         pthread_mutex_destroy(&forks[i]);
     }
     free(forks);
+    free(fork_spin);
+    if (cm_forks != NULL) {
+        for (int f = 0; f < num_philosophers; f++) {
+            pthread_mutex_destroy(&cm_forks[f].lock);
+            pthread_cond_destroy(&cm_forks[f].handed);
+        }
+        free(cm_forks);
+        cm_forks = NULL;
+    }
     sem_destroy(&waiter);
+    return seconds;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-b] [-t filosofos,...] [-v nivel] [-s pausas] [-S semilla] [-T carga] [-E carga] [-a waiter|order|trylock|cm|pool] [-w hilos] <num_philosophers> <num_ciclos_por_filosofo>\n"
+            "  -b  modo benchmark: sin log ni demoras, imprime CSV con comidas/s y esperas\n"
+            "  -t  (con -b) repite la corrida con esas cantidades de filósofos\n"
+            "  -v  nivel de log: 0 nada, 1 resumen, 2 un mensaje por evento (por omisión)\n"
+            "  -S  semilla de los tiempos de pensar y comer (por omisión, la hora)\n"
+            "  -a  estrategia: waiter (semáforo camarero, por omisión), order (solo el\n"
+            "      orden de los tenedores, sin camarero), trylock (suelta el primero si el\n"
+            "      segundo está ocupado y reintenta tras una espera aleatoria) o cm\n"
+            "      (Chandy-Misra, tenedores limpios/sucios que solo se piden entre vecinos)\n"
+            "      o pool (filósofos como tareas que corren -w hilos, para mesas grandes)\n"
+            "  -w  (con -a pool) hilos que corren a los filósofos (por omisión, uno por CPU)\n"
+            "  -T  tiempo de pensar: none, spin:T, sleep:T, spin:exp:MEDIA,\n"
+            "      spin:uniform:MIN:MAX o spin:bimodal:A:B:P (T con ns/us/ms/s; por\n"
+            "      omisión sleep:uniform:200ms:400ms, o none con -b)\n"
+            "  -E  tiempo de comer, igual que -T (por omisión sleep:uniform:250ms:500ms,\n"
+            "      o none con -b)\n"
+            "  -s  pausas de espera activa antes de dormir (0: nunca girar; por omisión\n"
+            "      %d, o 0 con una sola CPU)\n",
+            prog, SPIN_LIMIT_DEFAULT);
+    exit(EXIT_FAILURE);
+}
 
-    printf("Todos los filósofos han terminado.\n");
+int main(int argc, char *argv[]) {
+    int sizes[BENCH_MAX_RUNS];
+    int num_runs = 0;
+    int verbosity = LOG_EVENT;
+    int spin = -1;
+    uint64_t seed = (uint64_t)time(NULL);
+    const char *think_spec = NULL;
+    const char *eat_spec = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "bt:v:s:S:T:E:a:w:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark_mode = 1;
+            break;
+        case 't':
+            num_runs = bench_parse_list(optarg, sizes, BENCH_MAX_RUNS);
+            if (num_runs == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'v':
+            verbosity = atoi(optarg);
+            break;
+        case 's':
+            spin = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'a':
+            if (strcmp(optarg, "waiter") == 0) {
+                table_strategy = TABLE_WAITER;
+            } else if (strcmp(optarg, "order") == 0) {
+                table_strategy = TABLE_ORDER;
+            } else if (strcmp(optarg, "trylock") == 0) {
+                table_strategy = TABLE_TRYLOCK;
+            } else if (strcmp(optarg, "cm") == 0) {
+                table_strategy = TABLE_CHANDY_MISRA;
+            } else if (strcmp(optarg, "pool") == 0) {
+                table_strategy = TABLE_POOL;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            pool_workers = atoi(optarg);
+            if (pool_workers < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'T':
+            think_spec = optarg;
+            break;
+        case 'E':
+            eat_spec = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+    }
+
+    num_philosophers = atoi(argv[optind]);
+    cycles_per_philosopher = atoi(argv[optind + 1]);
+    if (!workload_parse(&think_work, think_spec ? think_spec
+                                     : benchmark_mode ? "none" : "sleep:uniform:200ms:400ms") ||
+        !workload_parse(&eat_work, eat_spec ? eat_spec
+                                   : benchmark_mode ? "none" : "sleep:uniform:250ms:500ms")) {
+        usage(argv[0]);
+    }
+
+    if (pool_workers == 0) {
+        pool_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    rng_configure(seed);
+
+    spin_configure(spin);
+
+    if (!benchmark_mode) {
+        log_start(verbosity);
+        log_msg(LOG_INFO, "Semilla: %llu\n", (unsigned long long)seed);
+        run_table();
+        log_msg(LOG_INFO, "Todos los filósofos han terminado.\n");
+        log_stop();
+        return 0;
+    }
+
+    if (num_runs == 0) {
+        sizes[num_runs++] = num_philosophers;
+    }
+    bench_csv_header();
+    for (int r = 0; r < num_runs; r++) {
+        num_philosophers = sizes[r];
+        long meals = (long)num_philosophers * cycles_per_philosopher;
+        bench_latency = malloc(sizeof(uint64_t) * meals);
+        if (!bench_latency) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        double seconds = run_table();
+        char variant[32];
+        if (table_strategy == TABLE_POOL) {
+            snprintf(variant, sizeof variant, "pool-w%d", pool_workers);
+        } else {
+            snprintf(variant, sizeof variant, "%s", table_strategy_names[table_strategy]);
+        }
+        bench_csv_row("dining_philosophers", variant, num_philosophers, 0,
+                      meals, seconds, bench_latency, meals);
+        free(bench_latency);
+    }
     return 0;
 }
@@ -0,0 +1,121 @@
+/*
+ * fsem.h
+ *
+ * Semáforo contador liviano sobre futex (Linux), usado por
+ * producer_consumer.c en lugar de sem_t. Sin contención fsem_wait() es un
+ * único CAS sobre el contador y fsem_post() un único fetch_add: el kernel
+ * solo interviene cuando de verdad hay alguien durmiendo.
+ *
+ * Antes de dormir, fsem_wait() gira según spin_wait() (spinwait.h), con un
+ * presupuesto que se ajusta a lo que tardan en llegar los permisos de ese
+ * semáforo, porque en el buffer suelen llegar enseguida. Un hilo que se
+ * duerme se anota en waiters y fsem_post() despierta exactamente a uno, así
+ * que liberar un permiso no despierta en estampida a todos los que esperan.
+ *
+ * fsem_wait_upto()/fsem_post_n() toman y devuelven varios permisos con una
+ * sola operación atómica, para que un lote de K ítems cueste lo mismo que
+ * uno. fsem_wait_upto() se conforma con los que haya (al menos uno): esperar
+ * a juntar K exactos podría no terminar si ya no van a llegar tantos.
+ */
+
+#ifndef FSEM_H
+#define FSEM_H
+
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "spinwait.h"
+
+typedef struct {
+    atomic_int count;   // permisos disponibles (nunca negativo)
+    atomic_int waiters; // hilos dormidos o por dormir en el futex
+    SpinTuner spin;
+} FSem;
+
+static inline void fsem_init(FSem *s, int value) {
+    atomic_init(&s->count, value);
+    atomic_init(&s->waiters, 0);
+    spin_tuner_init(&s->spin);
+}
+
+// Toma hasta max permisos de los que haya, sin esperar; devuelve cuántos tomó
+static inline int fsem_trywait_upto(FSem *s, int max) {
+    int c = atomic_load_explicit(&s->count, memory_order_relaxed);
+    while (c > 0) {
+        int n = c < max ? c : max;
+        if (atomic_compare_exchange_weak_explicit(&s->count, &c, c - n,
+                                                  memory_order_acquire,
+                                                  memory_order_relaxed)) {
+            return n;
+        }
+    }
+    return 0;
+}
+
+// Toma un permiso si hay alguno, sin esperar; devuelve 1 si lo tomó
+static inline int fsem_trywait(FSem *s) {
+    return fsem_trywait_upto(s, 1);
+}
+
+typedef struct {
+    FSem *sem;
+    int max;
+    int taken;
+} FSemAttempt;
+
+static int fsem_ready(void *arg) {
+    FSemAttempt *a = (FSemAttempt *)arg;
+    a->taken = fsem_trywait_upto(a->sem, a->max);
+    return a->taken > 0;
+}
+
+static int fsem_wait_slow(FSem *s, int max) {
+    FSemAttempt attempt = {s, max, 0};
+    if (spin_wait(&s->spin, fsem_ready, &attempt)) {
+        return attempt.taken;
+    }
+    uint64_t parked = bench_now_ns();
+    // Anotarse antes de volver a mirar el contador: un fsem_post() que no
+    // vea el aviso dejó su permiso visible para la lectura siguiente
+    atomic_fetch_add(&s->waiters, 1);
+    int n;
+    while ((n = fsem_trywait_upto(s, max)) == 0) {
+        // El kernel solo duerme al hilo si el contador sigue en 0
+        syscall(SYS_futex, &s->count, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+    }
+    atomic_fetch_sub(&s->waiters, 1);
+    spin_parked(&s->spin, bench_now_ns() - parked);
+    return n;
+}
+
+// Toma un permiso, esperando si no hay
+static inline void fsem_wait(FSem *s) {
+    if (!fsem_trywait(s)) {
+        fsem_wait_slow(s, 1);
+    }
+}
+
+// Toma entre 1 y max permisos (los que haya), esperando si no hay ninguno;
+// devuelve cuántos tomó
+static inline int fsem_wait_upto(FSem *s, int max) {
+    int n = fsem_trywait_upto(s, max);
+    return n > 0 ? n : fsem_wait_slow(s, max);
+}
+
+// Devuelve n permisos y despierta como mucho a n hilos dormidos (cada uno
+// se lleva al menos un permiso)
+static inline void fsem_post_n(FSem *s, int n) {
+    atomic_fetch_add(&s->count, n);
+    if (atomic_load(&s->waiters) > 0) {
+        syscall(SYS_futex, &s->count, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+    }
+}
+
+// Devuelve un permiso y despierta a un solo hilo si hay alguno dormido
+static inline void fsem_post(FSem *s) {
+    fsem_post_n(s, 1);
+}
+
+#endif
@@ -0,0 +1,221 @@
+/*
+ * log.h
+ *
+ * Log asíncrono para tsqueue.c, producer_consumer.c y dining_philosophers.c.
+ * Cada hilo escribe sus mensajes en un anillo propio (un productor, un
+ * consumidor, sin locks) y un hilo escritor los vacía a stdout, así que los
+ * hilos de trabajo nunca toman el lock de stdio ni esperan a la terminal,
+ * y menos dentro de una sección crítica.
+ *
+ * El nivel se elige al arrancar (-v en los tres programas):
+ *   LOG_QUIET  nada
+ *   LOG_INFO   solo mensajes de resumen
+ *   LOG_EVENT  además un mensaje por item/evento (valor por omisión)
+ *
+ * Cada mensaje lleva la marca de tiempo de CLOCK_MONOTONIC y el escritor
+ * intercala los anillos por esa marca, de modo que la salida respeta el
+ * orden en que ocurrieron los eventos dentro de cada pasada.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+enum { LOG_QUIET = 0, LOG_INFO = 1, LOG_EVENT = 2 };
+
+#define LOG_RING_SLOTS 256 // mensajes por hilo (potencia de dos)
+#define LOG_LINE 120       // bytes por mensaje, incluido el '\0'; si no entra, termina en "..."
+
+// Escribe el mensaje solo si el nivel elegido lo incluye; con el nivel
+// desactivado no se formatea nada
+#define log_msg(level, ...)                                                   \
+    do {                                                                      \
+        if (log_level >= (level)) {                                           \
+            log_write(__VA_ARGS__);                                           \
+        }                                                                     \
+    } while (0)
+
+typedef struct {
+    uint64_t stamp_ns;
+    char text[LOG_LINE];
+} LogRecord;
+
+// Anillo de un hilo: solo el hilo dueño avanza tail y solo el escritor
+// avanza head, cada uno en su propia línea de caché
+typedef struct LogRing {
+    _Alignas(64) atomic_size_t head;
+    _Alignas(64) atomic_size_t tail;
+    atomic_int orphaned;  // el hilo dueño terminó; el escritor lo libera
+    struct LogRing *next; // protegido por log_registry_lock
+    LogRecord records[LOG_RING_SLOTS];
+} LogRing;
+
+static int log_level = LOG_QUIET;
+static __thread LogRing *log_ring;
+static LogRing *log_registry;
+static pthread_mutex_t log_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_ring_key;
+static pthread_t log_writer_thread;
+static atomic_int log_stopping;
+
+// Destructor de la clave: al terminar un hilo su anillo queda huérfano y el
+// escritor lo libera cuando termina de vaciarlo
+static void log_ring_orphan(void *ring) {
+    atomic_store_explicit(&((LogRing *)ring)->orphaned, 1, memory_order_release);
+}
+
+// Primer mensaje de un hilo: crea su anillo y lo registra
+static LogRing *log_ring_attach(void) {
+    LogRing *ring = aligned_alloc(64, sizeof(LogRing));
+    if (!ring) {
+        perror("aligned_alloc log");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->orphaned, 0);
+    pthread_mutex_lock(&log_registry_lock);
+    ring->next = log_registry;
+    log_registry = ring;
+    pthread_mutex_unlock(&log_registry_lock);
+    pthread_setspecific(log_ring_key, ring);
+    log_ring = ring;
+    return ring;
+}
+
+__attribute__((format(printf, 1, 2)))
+static void log_write(const char *fmt, ...) {
+    LogRing *ring = log_ring ? log_ring : log_ring_attach();
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // Anillo lleno: esperar a que el escritor libere lugar (no se pierden mensajes)
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == LOG_RING_SLOTS) {
+        sched_yield();
+    }
+    LogRecord *rec = &ring->records[tail & (LOG_RING_SLOTS - 1)];
+    rec->stamp_ns = bench_now_ns();
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(rec->text, LOG_LINE, fmt, ap);
+    va_end(ap);
+    if (len >= LOG_LINE) {
+        // Mensaje cortado: marcarlo y conservar el fin de línea para que no
+        // se pegue con el siguiente
+        memcpy(rec->text + LOG_LINE - 5, "...\n", 5);
+    }
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// Escribe en stdout todo lo publicado hasta ahora, intercalando los anillos
+// por marca de tiempo, y libera los anillos huérfanos ya vacíos. Devuelve
+// cuántos mensajes escribió. El lock del registro solo se toma para elegir
+// el próximo mensaje: un hilo que registra su anillo nunca espera a que se
+// escriba en la terminal. Solo este hilo libera anillos, así que el elegido
+// sigue vivo después de soltar el lock
+static size_t log_drain(void) {
+    size_t written = 0;
+    for (;;) {
+        LogRing *oldest = NULL;
+        uint64_t oldest_stamp = 0;
+        pthread_mutex_lock(&log_registry_lock);
+        for (LogRing *r = log_registry; r; r = r->next) {
+            size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+            if (head == atomic_load_explicit(&r->tail, memory_order_acquire)) {
+                continue;
+            }
+            uint64_t stamp = r->records[head & (LOG_RING_SLOTS - 1)].stamp_ns;
+            if (!oldest || stamp < oldest_stamp) {
+                oldest = r;
+                oldest_stamp = stamp;
+            }
+        }
+        pthread_mutex_unlock(&log_registry_lock);
+        if (!oldest) {
+            break;
+        }
+        size_t head = atomic_load_explicit(&oldest->head, memory_order_relaxed);
+        fputs(oldest->records[head & (LOG_RING_SLOTS - 1)].text, stdout);
+        atomic_store_explicit(&oldest->head, head + 1, memory_order_release);
+        written++;
+    }
+    // Un anillo huérfano ya no recibe mensajes: si está vacío se libera
+    pthread_mutex_lock(&log_registry_lock);
+    for (LogRing **link = &log_registry; *link;) {
+        LogRing *r = *link;
+        if (atomic_load_explicit(&r->orphaned, memory_order_acquire) &&
+            atomic_load_explicit(&r->head, memory_order_relaxed) ==
+                atomic_load_explicit(&r->tail, memory_order_acquire)) {
+            *link = r->next;
+            free(r);
+        } else {
+            link = &r->next;
+        }
+    }
+    pthread_mutex_unlock(&log_registry_lock);
+    if (written > 0) {
+        fflush(stdout);
+    }
+    return written;
+}
+
+static void *log_writer(void *arg) {
+    (void)arg;
+    struct timespec idle = {0, 1000000}; // 1 ms
+    for (;;) {
+        // Leer la bandera antes de vaciar: todo lo escrito antes de
+        // log_stop() queda visible para esta última pasada
+        int stopping = atomic_load_explicit(&log_stopping, memory_order_acquire);
+        size_t written = log_drain();
+        if (stopping && written == 0) {
+            return NULL;
+        }
+        if (written == 0) {
+            nanosleep(&idle, NULL);
+        }
+    }
+}
+
+// Fija el nivel y, si hay algo que escribir, arranca el hilo escritor.
+// Llamar antes de crear los hilos de trabajo
+static void log_start(int level) {
+    log_level = level;
+    if (log_level == LOG_QUIET) {
+        return;
+    }
+    atomic_store(&log_stopping, 0);
+    pthread_key_create(&log_ring_key, log_ring_orphan);
+    if (pthread_create(&log_writer_thread, NULL, log_writer, NULL) != 0) {
+        perror("pthread_create log");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Vacía lo pendiente, detiene el escritor y libera los anillos. Llamar
+// después de esperar a los hilos de trabajo
+static void log_stop(void) {
+    if (log_level == LOG_QUIET) {
+        return;
+    }
+    atomic_store_explicit(&log_stopping, 1, memory_order_release);
+    pthread_join(log_writer_thread, NULL);
+    while (log_registry) {
+        LogRing *r = log_registry;
+        log_registry = r->next;
+        free(r);
+    }
+    log_ring = NULL;
+    pthread_key_delete(log_ring_key);
+    log_level = LOG_QUIET;
+}
+
+#endif
@@ -2,27 +2,182 @@
  * producer_consumer.c
  *
  * Solución al problema Productor‐Consumidor con buffer acotado,
- * usando semáforos POSIX (sem_t) y pthread_mutex_t.
+ * usando semáforos contadores y pthread_mutex_t. Los semáforos son los de
+ * fsem.h (contador atómico con espera en futex) en lugar de sem_t: sin
+ * contención esperar o liberar un permiso es una sola operación atómica.
+ * Antes de dormir en el futex giran un poco (spinwait.h); -s fija el máximo.
  *
- * Compilar: gcc producer_consumer.c -o producer_consumer -pthread -lrt
- * Uso: ./producer_consumer <num_producers> <num_consumers> <buffer_size> <items_per_producer>
+ * Con -m mpmc el buffer es en cambio un anillo lock-free de Vyukov: cada
+ * celda lleva un número de secuencia y productores y consumidores reservan
+ * posiciones con CAS, sin mutex ni semáforos en el camino de cada ítem.
+ * Con -m spsc (solo con un productor y un consumidor) cada lado avanza su
+ * índice sin CAS. En ambos modos se mantiene la capacidad buffer_size: un
+ * productor que encuentra el anillo lleno (o un consumidor que lo encuentra
+ * vacío) cede la CPU y reintenta. El anillo mpmc necesita al menos 2
+ * celdas: con una sola, "lista para el consumidor" y "libre para el
+ * próximo productor" son el mismo número de secuencia.
+ *
+ * Con -m shard cada productor tiene su propia deque acotada (Chase-Lev, sin
+ * la operación pop del dueño): el productor empuja al fondo sin CAS y los
+ * consumidores sacan del tope con CAS, primero de su deque de afinidad
+ * (consumidor c -> deque c % productores) y, si está vacía, robando de las
+ * demás. Así los hilos no se disputan un único par de índices. La capacidad
+ * total se reparte entre las deques.
+ *
+ * Con -r bytes cada ítem es un mensaje de ese tamaño (record.h): los
+ * registros se reservan todos al arrancar, el productor arma el mensaje en
+ * su registro y por el buffer solo viaja el índice; el consumidor lo lee en
+ * su lugar, verifica su contenido y lo devuelve al pool.
+ *
+ * En los anillos (-m mpmc y spsc) con -r ni siquiera hace falta el pool:
+ * cada posición del anillo tiene lugar para un registro y el buffer ofrece
+ * una API sin copias. buffer_reserve(n) reserva hasta n posiciones
+ * contiguas y devuelve dónde escribir; buffer_commit() las publica. Del
+ * otro lado, buffer_peek(n) devuelve hasta n registros publicados para
+ * leerlos en el anillo mismo y buffer_release() libera esas posiciones.
+ * El mensaje se escribe una sola vez, directamente en el anillo.
+ *
+ * Al terminar los productores, main deja en el buffer un ítem veneno por
+ * consumidor (en el modo shard, marca shards_done), espera a que todos
+ * salgan e informa el tiempo total.
+ *
+ * Compilar: gcc producer_consumer.c -o producer_consumer -pthread -lrt -lm
+ * Uso: ./producer_consumer [-b] [-t hilos,...] [-v nivel] [-s pausas] [-m sem|mpmc|spsc|shard] [-r bytes] [-S semilla] [-P carga] [-C carga] [-k lote] <num_producers> <num_consumers> <buffer_size> <items_per_producer>
+ *
+ * -b activa el modo benchmark: sin log ni demoras, imprime en CSV (ver
+ * bench.h) ops/s y los percentiles p50/p99/p999 de la latencia entre que un
+ * ítem se produce y se consume; -t 1,2,4,8 repite la corrida con esas
+ * cantidades de productores y consumidores.
+ *
+ * -P y -C describen el trabajo de producir y de consumir cada ítem con el
+ * modelo de carga de workload.h (p. ej. "spin:2us" o "spin:exp:5us"); por
+ * omisión el demo duerme 100 ms y 120 ms como siempre y el benchmark no
+ * demora nada, pero -P/-C valen también con -b para medir el costo de la
+ * sincronización con tiempos de servicio realistas.
+ *
+ * -k K hace que cada productor publique sus ítems en lotes de K y cada
+ * consumidor saque hasta K de una vez. Con semáforos el lote entero cuesta
+ * una sola operación por semáforo (fsem_wait_upto/fsem_post_n) y una sola
+ * toma del mutex; en los anillos sin copias (-r con mpmc/spsc) el lote se
+ * reserva como un tramo; en los demás modos los ítems pasan de a uno.
+ *
+ * Los valores aleatorios salen de un generador propio de cada hilo
+ * (rng.h) en vez de rand(), que toma un lock interno; -S fija la semilla
+ * para repetir una corrida (por omisión, la hora).
+ *
+ * Los mensajes por item pasan por el log asíncrono de log.h y se emiten
+ * fuera de la sección crítica del buffer; -v 0|1|2 elige el nivel (2, un
+ * mensaje por item, es el valor por omisión).
  */
 
 #include <pthread.h>
-#include <semaphore.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 
+#include "bench.h"
+#include "fsem.h"
+#include "log.h"
+#include "record.h"
+#include "rng.h"
+#include "workload.h"
+
 int *buffer;          // Array que actúa como buffer circular
 int buffer_size;      // Tamaño máximo del buffer
 int in = 0, out = 0;  // Índices para productor (in) y consumidor (out)
 
-sem_t empty_slots;    // Cuenta espacios vacíos
-sem_t full_slots;     // Cuenta elementos disponibles
+FSem empty_slots;     // Cuenta espacios vacíos
+FSem full_slots;      // Cuenta elementos disponibles
 pthread_mutex_t mutex_buffer;
 
+// Ítem "veneno": cuando los productores terminan, main deja uno por
+// consumidor en el buffer y cada consumidor sale al recibirlo (en el modo
+// shard lo devuelve buffer_take() al ver todo vacío). Los ítems reales
+// nunca son negativos
+#define POISON_PILL (-1)
+
+// Implementación del buffer, elegida al arrancar con -m
+typedef enum { BUFFER_SEM, BUFFER_MPMC, BUFFER_SPSC, BUFFER_SHARD } BufferMode;
+static BufferMode buffer_mode = BUFFER_SEM;
+static const char *const buffer_mode_names[] = {"sem_mutex", "mpmc", "spsc", "shard"};
+
+// Anillo MPMC (-m mpmc): la celda de la posición pos está libre para el
+// productor cuando seq == pos y lista para el consumidor cuando
+// seq == pos + 1; al vaciarla el consumidor la deja en pos + buffer_size
+typedef struct {
+    atomic_size_t seq;
+    int value;
+} RingCell;
+
+static RingCell *ring_cells;
+
+// Próxima posición a escribir y a leer en los modos mpmc y spsc, en líneas
+// de caché separadas porque las modifican lados distintos
+static _Alignas(64) atomic_size_t ring_enqueue_pos;
+static _Alignas(64) atomic_size_t ring_dequeue_pos;
+
+// Modo spsc: copia local que cada lado guarda del índice del otro, para no
+// leer la línea de caché ajena mientras haya lugar (o ítems) de sobra
+static _Alignas(64) size_t spsc_dequeue_cache; // solo la usa el productor
+static _Alignas(64) size_t spsc_enqueue_cache; // solo la usa el consumidor
+
+// -r en los modos mpmc y spsc: el registro de la posición i vive en
+// slot_data + i * slot_stride, contiguo al de la posición siguiente
+static int zero_copy;
+static unsigned char *slot_data;
+static size_t slot_stride;
+
+// Tramo de posiciones contiguas reservadas (productor) o leídas
+// (consumidor) con la API sin copias
+typedef struct {
+    size_t pos;          // primera posición del tramo
+    int count;           // cuántas posiciones abarca
+    unsigned char *data; // registro de la primera posición
+} BufferSpan;
+
+static inline Record *span_record(const BufferSpan *span, int i) {
+    return (Record *)(span->data + (size_t)i * slot_stride);
+}
+
+// Modo shard: una deque por productor. bottom solo lo escribe el productor
+// dueño; top lo avanzan con CAS los consumidores que sacan (o roban). Las
+// celdas son atómicas porque un ladrón con un top viejo puede leer una
+// celda que el dueño ya está reutilizando (su CAS falla y descarta el valor)
+typedef struct {
+    _Alignas(64) atomic_size_t top;
+    _Alignas(64) atomic_size_t bottom;
+    atomic_int *cells;
+} Shard;
+
+static Shard *shards;
+static int num_shards;
+static int shard_capacity;
+static atomic_int shards_done;    // los productores ya terminaron
+static __thread int shard_home;   // deque propia (productor) o de afinidad (consumidor)
+
+// Con -r, bytes por mensaje; los ítems del buffer son índices en records
+static int record_size = 0;
+static RecordPool records;
+
+// Modo benchmark (-b): cada ítem es un índice en bench_latency, donde el
+// productor anota cuándo lo produjo y el consumidor lo reemplaza por la
+// latencia
+static int benchmark_mode = 0;
+static uint64_t *bench_latency;
+static long bench_total;
+
+// Ítems por lote (-k): cada productor publica y cada consumidor saca de a
+// tantos
+static int batch_size = 1;
+
+// Trabajo simulado por ítem (-P y -C)
+static Workload produce_work;
+static Workload consume_work;
+
 typedef struct {
     int id;
     int items_to_produce;
@@ -35,75 +190,496 @@ typedef struct {
 
 // Función que simula producción de un ítem (valor aleatorio)
 int produce_item() {
-    return rand() % 1000;
+    return rng_below(1000);
 }
 
 // Función que simula consumo de un ítem
 void consume_item(int item) {
-    // Por simplicidad, solo dormimos un breve tiempo
-    usleep(120000);
+    // El tiempo de servicio lo da el modelo de carga (-C)
+    workload_run(&consume_work);
 }
 
-void *producer(void *arg) {
-    ProducerArgs *args = (ProducerArgs *)arg;
-    for (int i = 0; i < args->items_to_produce; i++) {
-        int item = produce_item();
-        // Esperar si no hay espacios vacíos
-        sem_wait(&empty_slots);
-        // Sección crítica para agregar al buffer
+// Agrega item al buffer, esperando si está lleno; devuelve el índice usado
+static int buffer_put(int item) {
+    size_t pos;
+    switch (buffer_mode) {
+    case BUFFER_MPMC:
+        pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
+        for (;;) {
+            RingCell *cell = &ring_cells[pos % buffer_size];
+            size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+            long dif = (long)(seq - pos);
+            if (dif == 0) {
+                // Celda libre: reservar la posición
+                if (atomic_compare_exchange_weak_explicit(&ring_enqueue_pos, &pos, pos + 1,
+                                                          memory_order_relaxed,
+                                                          memory_order_relaxed)) {
+                    cell->value = item;
+                    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+                    return (int)(pos % buffer_size);
+                }
+            } else {
+                if (dif < 0) {
+                    sched_yield(); // lleno: la celda aún no fue consumida
+                }
+                pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
+            }
+        }
+    case BUFFER_SPSC:
+        pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
+        while (pos - spsc_dequeue_cache == (size_t)buffer_size) {
+            spsc_dequeue_cache = atomic_load_explicit(&ring_dequeue_pos, memory_order_acquire);
+            if (pos - spsc_dequeue_cache == (size_t)buffer_size) {
+                sched_yield();
+            }
+        }
+        buffer[pos % buffer_size] = item;
+        atomic_store_explicit(&ring_enqueue_pos, pos + 1, memory_order_release);
+        return (int)(pos % buffer_size);
+    case BUFFER_SHARD: {
+        Shard *shard = &shards[shard_home];
+        pos = atomic_load_explicit(&shard->bottom, memory_order_relaxed);
+        while (pos - atomic_load_explicit(&shard->top, memory_order_acquire) >=
+               (size_t)shard_capacity) {
+            sched_yield(); // deque llena
+        }
+        atomic_store_explicit(&shard->cells[pos % shard_capacity], item, memory_order_relaxed);
+        atomic_store_explicit(&shard->bottom, pos + 1, memory_order_release);
+        return (int)(pos % shard_capacity);
+    }
+    default:
+        break;
+    }
+
+    // Esperar si no hay espacios vacíos
+    fsem_wait(&empty_slots);
+    // Sección crítica para agregar al buffer
+    pthread_mutex_lock(&mutex_buffer);
+    int slot = in;
+    buffer[in] = item;
+    in = (in + 1) % buffer_size;
+    pthread_mutex_unlock(&mutex_buffer);
+    // Señalar que hay un elemento disponible
+    fsem_post(&full_slots);
+    return slot;
+}
+
+// Saca el ítem del tope de una deque; -1 si estaba vacía o si otro
+// consumidor ganó el CAS
+static int shard_steal(Shard *shard, int *item) {
+    // Como el dueño nunca saca, no hace falta la barrera seq_cst entre top
+    // y bottom del Chase-Lev original (protege la carrera pop contra robo)
+    size_t top = atomic_load_explicit(&shard->top, memory_order_acquire);
+    size_t bottom = atomic_load_explicit(&shard->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return -1;
+    }
+    int value = atomic_load_explicit(&shard->cells[top % shard_capacity], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&shard->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return -1;
+    }
+    *item = value;
+    return (int)(top % shard_capacity);
+}
+
+// Saca un ítem del buffer, esperando si está vacío; devuelve el índice leído
+static int buffer_take(int *item) {
+    size_t pos;
+    switch (buffer_mode) {
+    case BUFFER_MPMC:
+        pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+        for (;;) {
+            RingCell *cell = &ring_cells[pos % buffer_size];
+            size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+            long dif = (long)(seq - (pos + 1));
+            if (dif == 0) {
+                // Celda con dato: reservar la posición
+                if (atomic_compare_exchange_weak_explicit(&ring_dequeue_pos, &pos, pos + 1,
+                                                          memory_order_relaxed,
+                                                          memory_order_relaxed)) {
+                    *item = cell->value;
+                    atomic_store_explicit(&cell->seq, pos + buffer_size, memory_order_release);
+                    return (int)(pos % buffer_size);
+                }
+            } else {
+                if (dif < 0) {
+                    sched_yield(); // vacío: la celda aún no fue escrita
+                }
+                pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+            }
+        }
+    case BUFFER_SPSC:
+        pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+        while (pos == spsc_enqueue_cache) {
+            spsc_enqueue_cache = atomic_load_explicit(&ring_enqueue_pos, memory_order_acquire);
+            if (pos == spsc_enqueue_cache) {
+                sched_yield();
+            }
+        }
+        *item = buffer[pos % buffer_size];
+        atomic_store_explicit(&ring_dequeue_pos, pos + 1, memory_order_release);
+        return (int)(pos % buffer_size);
+    case BUFFER_SHARD:
+        for (;;) {
+            // done se lee antes de recorrer: si ya estaba puesto y ninguna
+            // deque tiene nada, no va a llegar nada más
+            int done = atomic_load_explicit(&shards_done, memory_order_acquire);
+            for (int i = 0; i < num_shards; i++) {
+                int slot = shard_steal(&shards[(shard_home + i) % num_shards], item);
+                if (slot >= 0) {
+                    return slot;
+                }
+            }
+            if (done) {
+                *item = POISON_PILL;
+                return -1;
+            }
+            sched_yield(); // todas vacías
+        }
+    default:
+        break;
+    }
+
+    // Esperar a que haya al menos un elemento
+    fsem_wait(&full_slots);
+    // Sección crítica para remover del buffer
+    pthread_mutex_lock(&mutex_buffer);
+    int slot = out;
+    *item = buffer[out];
+    out = (out + 1) % buffer_size;
+    pthread_mutex_unlock(&mutex_buffer);
+    // Señalar que hay un espacio libre
+    fsem_post(&empty_slots);
+    return slot;
+}
+
+// Agrega los n ítems de items, esperando si hace falta, y anota en slots el
+// índice que ocupó cada uno. Con semáforos cada tanda de ítems cuesta una
+// sola operación por semáforo y una sola toma del mutex; los demás modos
+// agregan de a uno
+static void buffer_put_batch(const int *items, int n, int *slots) {
+    if (buffer_mode != BUFFER_SEM) {
+        for (int i = 0; i < n; i++) {
+            slots[i] = buffer_put(items[i]);
+        }
+        return;
+    }
+    for (int done = 0; done < n;) {
+        // Tantos espacios como haya libres, hasta lo que falta del lote
+        int k = fsem_wait_upto(&empty_slots, n - done);
         pthread_mutex_lock(&mutex_buffer);
-        buffer[in] = item;
-        printf("[Producer %d] produjo: %d, lo puso en buffer[%d]\n",
-               args->id, item, in);
-        in = (in + 1) % buffer_size;
+        for (int i = done; i < done + k; i++) {
+            slots[i] = in;
+            buffer[in] = items[i];
+            in = (in + 1) % buffer_size;
+        }
         pthread_mutex_unlock(&mutex_buffer);
-        // Señalar que hay un elemento disponible
-        sem_post(&full_slots);
-        usleep(100000); // Simular algo de tiempo de producción
+        fsem_post_n(&full_slots, k);
+        done += k;
     }
-    return NULL;
 }
 
-void *consumer(void *arg) {
-    ConsumerArgs *args = (ConsumerArgs *)arg;
-    while (1) {
-        // Esperar a que haya al menos un elemento
-        sem_wait(&full_slots);
-        // Sección crítica para remover del buffer
-        pthread_mutex_lock(&mutex_buffer);
-        int item = buffer[out];
-        printf("[Consumer %d] consumió: %d de buffer[%d]\n",
-               args->id, item, out);
+// Saca entre 1 y max ítems (con semáforos, los que haya hasta max; en los
+// demás modos, uno) esperando si el buffer está vacío; devuelve cuántos
+static int buffer_take_batch(int *items, int max, int *slots) {
+    if (buffer_mode != BUFFER_SEM) {
+        slots[0] = buffer_take(&items[0]);
+        return 1;
+    }
+    int k = fsem_wait_upto(&full_slots, max);
+    pthread_mutex_lock(&mutex_buffer);
+    for (int i = 0; i < k; i++) {
+        slots[i] = out;
+        items[i] = buffer[out];
         out = (out + 1) % buffer_size;
-        pthread_mutex_unlock(&mutex_buffer);
-        // Señalar que hay un espacio libre
-        sem_post(&empty_slots);
-        // Simular consumo
-        consume_item(item);
+    }
+    pthread_mutex_unlock(&mutex_buffer);
+    fsem_post_n(&empty_slots, k);
+    return k;
+}
 
-        // Condición de salida: si se produce un item especial, o podríamos
-        // decidir un contador global. Aquí, salimos cuando se han consumido
-        // todos los items posibles (control externo).
-        // Para simplificar, no implementamos conteo final; se asumirá que
-        // el usuario interrumpe con Ctrl+C o se usa un contador externo.
+// Reserva entre 1 y n posiciones contiguas (el tramo se corta al final del
+// anillo), esperando si está lleno. El llamador escribe sus registros con
+// span_record() y los publica con buffer_commit(). Con mpmc usa los mismos
+// números de secuencia que buffer_put(), así que también necesita al menos
+// 2 celdas (main() lo exige)
+static void buffer_reserve(int n, BufferSpan *span) {
+    size_t pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
+    int count;
+    for (;;) {
+        size_t first = pos % buffer_size;
+        int want = n < buffer_size - (int)first ? n : buffer_size - (int)first;
+        count = 0;
+        if (buffer_mode == BUFFER_SPSC) {
+            size_t space = buffer_size - (pos - spsc_dequeue_cache);
+            if (space == 0) {
+                spsc_dequeue_cache = atomic_load_explicit(&ring_dequeue_pos, memory_order_acquire);
+                space = buffer_size - (pos - spsc_dequeue_cache);
+            }
+            count = (size_t)want < space ? want : (int)space;
+            if (count > 0) {
+                // Un solo productor: nadie más mueve ring_enqueue_pos
+                break;
+            }
+        } else {
+            // Contar las celdas libres en esta vuelta. Una celda libre no
+            // deja de estarlo mientras nadie avance ring_enqueue_pos, así que
+            // si el CAS sale bien todas siguen siendo nuestras
+            while (count < want &&
+                   atomic_load_explicit(&ring_cells[first + count].seq, memory_order_acquire) ==
+                       pos + count) {
+                count++;
+            }
+            if (count > 0) {
+                if (atomic_compare_exchange_weak_explicit(&ring_enqueue_pos, &pos, pos + count,
+                                                          memory_order_relaxed,
+                                                          memory_order_relaxed)) {
+                    break;
+                }
+                continue; // otro productor ganó: pos ya trae el valor nuevo
+            }
+            if ((long)(atomic_load_explicit(&ring_cells[first].seq, memory_order_relaxed) - pos) > 0) {
+                // Otro productor ya reservó pos: reintentar desde la posición actual
+                pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
+                continue;
+            }
+        }
+        sched_yield(); // lleno: la celda aún no fue consumida
+        pos = atomic_load_explicit(&ring_enqueue_pos, memory_order_relaxed);
     }
-    return NULL;
+    span->pos = pos;
+    span->count = count;
+    span->data = slot_data + (pos % buffer_size) * slot_stride;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 5) {
-        fprintf(stderr,
-                "Uso: %s <num_producers> <num_consumers> <buffer_size> <items_per_producer>\n",
-                argv[0]);
+// Publica los registros escritos en un tramo de buffer_reserve()
+static void buffer_commit(const BufferSpan *span) {
+    if (buffer_mode == BUFFER_SPSC) {
+        atomic_store_explicit(&ring_enqueue_pos, span->pos + span->count, memory_order_release);
+        return;
+    }
+    size_t first = span->pos % buffer_size;
+    for (int i = 0; i < span->count; i++) {
+        atomic_store_explicit(&ring_cells[first + i].seq, span->pos + i + 1, memory_order_release);
+    }
+}
+
+// Toma entre 1 y n registros publicados y contiguos, esperando si el anillo
+// está vacío. Siguen en el anillo hasta buffer_release()
+static void buffer_peek(int n, BufferSpan *span) {
+    size_t pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+    int count;
+    for (;;) {
+        size_t first = pos % buffer_size;
+        int want = n < buffer_size - (int)first ? n : buffer_size - (int)first;
+        count = 0;
+        if (buffer_mode == BUFFER_SPSC) {
+            size_t ready = spsc_enqueue_cache - pos;
+            if (ready == 0) {
+                spsc_enqueue_cache = atomic_load_explicit(&ring_enqueue_pos, memory_order_acquire);
+                ready = spsc_enqueue_cache - pos;
+            }
+            count = (size_t)want < ready ? want : (int)ready;
+            if (count > 0) {
+                break;
+            }
+        } else {
+            while (count < want &&
+                   atomic_load_explicit(&ring_cells[first + count].seq, memory_order_acquire) ==
+                       pos + count + 1) {
+                count++;
+            }
+            if (count > 0) {
+                if (atomic_compare_exchange_weak_explicit(&ring_dequeue_pos, &pos, pos + count,
+                                                          memory_order_relaxed,
+                                                          memory_order_relaxed)) {
+                    break;
+                }
+                continue;
+            }
+            if ((long)(atomic_load_explicit(&ring_cells[first].seq, memory_order_relaxed) - (pos + 1)) > 0) {
+                pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+                continue;
+            }
+        }
+        sched_yield(); // vacío: la celda aún no fue escrita
+        pos = atomic_load_explicit(&ring_dequeue_pos, memory_order_relaxed);
+    }
+    span->pos = pos;
+    span->count = count;
+    span->data = slot_data + (pos % buffer_size) * slot_stride;
+}
+
+// Devuelve al productor las posiciones de un tramo de buffer_peek()
+static void buffer_release(const BufferSpan *span) {
+    if (buffer_mode == BUFFER_SPSC) {
+        atomic_store_explicit(&ring_dequeue_pos, span->pos + span->count, memory_order_release);
+        return;
+    }
+    size_t first = span->pos % buffer_size;
+    for (int i = 0; i < span->count; i++) {
+        atomic_store_explicit(&ring_cells[first + i].seq, span->pos + i + buffer_size,
+                              memory_order_release);
+    }
+}
+
+// Deja un ítem veneno en el buffer
+static void buffer_put_pill(void) {
+    if (zero_copy) {
+        BufferSpan span;
+        buffer_reserve(1, &span);
+        record_fill(span_record(&span, 0), POISON_PILL, 0);
+        buffer_commit(&span);
+    } else {
+        buffer_put(POISON_PILL);
+    }
+}
+
+void *producer(void *arg) {
+    ProducerArgs *args = (ProducerArgs *)arg;
+    shard_home = args->id;
+    rng_thread_init(args->id);
+    RecordCache cache;
+    record_cache_init(&cache);
+    // Los tres arreglos del lote, en el heap porque -k puede ser grande
+    int *items = malloc(sizeof(int) * 3 * batch_size); // valores del lote
+    if (items == NULL) {
+        perror("malloc lote");
         exit(EXIT_FAILURE);
     }
+    int *handles = items + batch_size; // lo que viaja por el buffer (valor o registro)
+    int *slots = items + 2 * batch_size;
+    int n = 0;
+    for (int i = 0; i < args->items_to_produce; i++) {
+        int item;
+        if (benchmark_mode) {
+            item = args->id * args->items_to_produce + i;
+            bench_latency[item] = bench_now_ns();
+        } else {
+            item = produce_item();
+        }
+        items[n] = handles[n] = item;
+        if (record_size > 0 && !zero_copy) {
+            // Armar el mensaje directamente en su registro; el registro pasa
+            // al consumidor junto con el índice
+            handles[n] = record_acquire(&records, &cache);
+            record_fill(record_at(&records, handles[n]), item, record_size);
+        }
+        n++;
+        workload_run(&produce_work); // Simular algo de tiempo de producción
+        if (n < batch_size && i + 1 < args->items_to_produce) {
+            continue;
+        }
 
-    int num_producers = atoi(argv[1]);
-    int num_consumers = atoi(argv[2]);
-    buffer_size = atoi(argv[3]);
-    int items_per_producer = atoi(argv[4]);
+        // Lote completo (o último): publicarlo de una vez
+        if (zero_copy) {
+            // Escribir los mensajes directamente en el anillo, en tantos
+            // tramos como haga falta
+            for (int done = 0; done < n;) {
+                BufferSpan span;
+                buffer_reserve(n - done, &span);
+                for (int k = 0; k < span.count; k++) {
+                    record_fill(span_record(&span, k), items[done + k], record_size);
+                    slots[done + k] = (int)((span.pos + k) % buffer_size);
+                }
+                buffer_commit(&span);
+                done += span.count;
+            }
+        } else {
+            buffer_put_batch(handles, n, slots);
+        }
+        for (int k = 0; k < n; k++) {
+            log_msg(LOG_EVENT, "[Producer %d] produjo: %d, lo puso en buffer[%d]\n",
+                    args->id, items[k], slots[k]);
+        }
+        n = 0;
+    }
+    if (record_size > 0) {
+        record_cache_flush(&records, &cache);
+    }
+    free(items);
+    return NULL;
+}
 
-    srand(time(NULL));
+void *consumer(void *arg) {
+    ConsumerArgs *args = (ConsumerArgs *)arg;
+    shard_home = num_shards > 0 ? args->id % num_shards : 0;
+    rng_thread_init(0x100000000ULL + args->id); // aparte de los productores
+    RecordCache cache;
+    record_cache_init(&cache);
+    int *items = malloc(sizeof(int) * 2 * batch_size);
+    if (items == NULL) {
+        perror("malloc lote");
+        exit(EXIT_FAILURE);
+    }
+    int *slots = items + batch_size;
+    int pills = 0;
+    while (pills == 0) {
+        int n;
+        if (zero_copy) {
+            // Leer los mensajes en el anillo y recién después liberar las posiciones
+            BufferSpan span;
+            buffer_peek(batch_size, &span);
+            for (int k = 0; k < span.count; k++) {
+                Record *rec = span_record(&span, k);
+                if (rec->id != POISON_PILL && !record_check(rec)) {
+                    fprintf(stderr, "[Consumer %d] registro en buffer[%d] corrupto\n",
+                            args->id, (int)((span.pos + k) % buffer_size));
+                    exit(EXIT_FAILURE);
+                }
+                items[k] = rec->id;
+                slots[k] = (int)((span.pos + k) % buffer_size);
+            }
+            n = span.count;
+            buffer_release(&span);
+        } else {
+            n = buffer_take_batch(items, batch_size, slots);
+        }
+        for (int k = 0; k < n; k++) {
+            int item = items[k];
+            if (item == POISON_PILL) {
+                // Los venenos van detrás de todos los ítems reales: lo que
+                // queda del lote son más venenos
+                pills++;
+                continue;
+            }
+            if (record_size > 0 && !zero_copy) {
+                // Leer el mensaje en su lugar y devolver el registro
+                int handle = item;
+                Record *rec = record_at(&records, handle);
+                if (!record_check(rec)) {
+                    fprintf(stderr, "[Consumer %d] registro %d corrupto\n", args->id, handle);
+                    exit(EXIT_FAILURE);
+                }
+                item = rec->id;
+                record_release(&records, &cache, handle);
+            }
+            log_msg(LOG_EVENT, "[Consumer %d] consumió: %d de buffer[%d]\n",
+                    args->id, item, slots[k]);
+            if (benchmark_mode) {
+                bench_latency[item] = bench_now_ns() - bench_latency[item];
+            }
+            // Simular consumo
+            consume_item(item);
+        }
+    }
+    // Un veneno por consumidor: los que se llevó de más son de otros
+    while (--pills > 0) {
+        buffer_put_pill();
+    }
+    if (record_size > 0) {
+        record_cache_flush(&records, &cache);
+    }
+    free(items);
+    return NULL;
+}
+
+// Lanza consumidores y productores sobre el buffer, espera a que terminen
+// todos y devuelve los segundos transcurridos
+static double run_buffer(int num_producers, int num_consumers, int items_per_producer) {
+    in = out = 0;
 
     // Reservar buffer dinámicamente
     buffer = (int *)malloc(sizeof(int) * buffer_size);
@@ -113,15 +689,70 @@ int main(int argc, char *argv[]) {
     }
 
     // Inicializar semáforos
-    sem_init(&empty_slots, 0, buffer_size); // inicialmente todos los slots vacíos
-    sem_init(&full_slots, 0, 0);            // inicialmente no hay elementos
+    fsem_init(&empty_slots, buffer_size); // inicialmente todos los slots vacíos
+    fsem_init(&full_slots, 0);            // inicialmente no hay elementos
     pthread_mutex_init(&mutex_buffer, NULL);
 
+    // Anillos lock-free: todas las celdas libres para la vuelta 0
+    atomic_store(&ring_enqueue_pos, 0);
+    atomic_store(&ring_dequeue_pos, 0);
+    spsc_dequeue_cache = spsc_enqueue_cache = 0;
+    if (buffer_mode == BUFFER_MPMC) {
+        ring_cells = malloc(sizeof(RingCell) * buffer_size);
+        if (ring_cells == NULL) {
+            perror("malloc ring");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < buffer_size; i++) {
+            atomic_init(&ring_cells[i].seq, i);
+        }
+    }
+    if (buffer_mode == BUFFER_SHARD) {
+        // La capacidad total se reparte entre las deques (al menos 1 cada una)
+        num_shards = num_producers;
+        shard_capacity = (buffer_size + num_shards - 1) / num_shards;
+        atomic_store(&shards_done, 0);
+        shards = aligned_alloc(64, sizeof(Shard) * num_shards);
+        if (shards == NULL) {
+            perror("malloc shards");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < num_shards; i++) {
+            atomic_init(&shards[i].top, 0);
+            atomic_init(&shards[i].bottom, 0);
+            shards[i].cells = malloc(sizeof(atomic_int) * shard_capacity);
+            if (shards[i].cells == NULL) {
+                perror("malloc shards");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    zero_copy = record_size > 0 &&
+                (buffer_mode == BUFFER_MPMC || buffer_mode == BUFFER_SPSC);
+    if (zero_copy) {
+        // Un registro por posición, contiguos para que un tramo sea un solo bloque
+        slot_stride = record_stride(record_size);
+        slot_data = aligned_alloc(RECORD_ALIGN, slot_stride * buffer_size);
+        if (slot_data == NULL) {
+            perror("aligned_alloc slots");
+            exit(EXIT_FAILURE);
+        }
+    } else if (record_size > 0) {
+        // En vuelo: lo que cabe en el buffer (las deques de shard redondean
+        // hacia arriba) más el lote que cada hilo tiene en la mano
+        record_pool_init(&records,
+                         buffer_size + num_producers * (batch_size + 1) + num_consumers * batch_size,
+                         num_producers + num_consumers, record_size);
+    }
+
     pthread_t producers[num_producers];
     pthread_t consumers[num_consumers];
     ProducerArgs pargs[num_producers];
     ConsumerArgs cargs[num_consumers];
 
+    uint64_t start = bench_now_ns();
+
     // Crear hilos consumidores primero (para que esperen si el buffer está vacío)
     for (int i = 0; i < num_consumers; i++) {
         cargs[i].id = i;
@@ -142,25 +773,217 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Esperar a que los productores terminen (los consumidores quedan activos)
+    // Esperar a que los productores terminen
     for (int i = 0; i < num_producers; i++) {
         pthread_join(producers[i], NULL);
     }
 
-    // Después de que todos los productores terminaron, podemos terminar
-    // el programa. En un caso real, podríamos enviar señales a consumidores
-    // para que paren. Aquí, esperaremos unos segundos y luego saldremos.
-    sleep(2);
-
-    // Aunque no limpiamos a los consumidores de forma limpia, para propósitos
-    // de demostración finalizamos el programa:
-    printf("Productores terminaron. Fin del programa.\n");
+    if (buffer_mode == BUFFER_SHARD) {
+        // Con varias deques un veneno no va detrás de todo lo demás: los
+        // consumidores salen cuando ven la bandera y todas las deques vacías
+        atomic_store_explicit(&shards_done, 1, memory_order_release);
+    } else {
+        // Un veneno por consumidor: van detrás de todos los ítems reales,
+        // así que cada consumidor sale recién cuando el buffer quedó vacío
+        for (int i = 0; i < num_consumers; i++) {
+            buffer_put_pill();
+        }
+    }
+    for (int i = 0; i < num_consumers; i++) {
+        pthread_join(consumers[i], NULL);
+    }
+    double seconds = (bench_now_ns() - start) / 1e9;
 
-    // Destruir semáforos y mutex
-    sem_destroy(&empty_slots);
-    sem_destroy(&full_slots);
+    // Destruir mutex (los FSem no reservan nada)
     pthread_mutex_destroy(&mutex_buffer);
+    free(ring_cells);
+    ring_cells = NULL;
+    for (int i = 0; i < num_shards; i++) {
+        free(shards[i].cells);
+    }
+    free(shards);
+    shards = NULL;
+    num_shards = 0;
     free(buffer);
+    free(slot_data);
+    slot_data = NULL;
+    if (record_size > 0 && !zero_copy) {
+        record_pool_destroy(&records);
+    }
+    return seconds;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-b] [-t hilos,...] [-v nivel] [-s pausas] [-m sem|mpmc|spsc|shard] [-r bytes] [-S semilla] [-P carga] [-C carga] [-k lote] <num_producers> <num_consumers> <buffer_size> <items_per_producer>\n"
+            "  -b  modo benchmark: sin log ni demoras, imprime CSV con ops/s y latencias\n"
+            "  -t  (con -b) repite la corrida con esa cantidad de productores y de consumidores\n"
+            "  -v  nivel de log: 0 nada, 1 resumen, 2 un mensaje por item (por omisión)\n"
+            "  -m  buffer: sem (semáforos y mutex, por omisión), mpmc (anillo lock-free)\n"
+            "      spsc (anillo lock-free para 1 productor y 1 consumidor) o shard\n"
+            "      (una deque por productor, los consumidores roban de las otras)\n"
+            "  -r  cada ítem es un mensaje de ese tamaño en bytes (0: un int, por omisión);\n"
+            "      con mpmc y spsc se escribe y se lee directamente en el anillo\n"
+            "  -S  semilla de los valores aleatorios (por omisión, la hora)\n"
+            "  -P  trabajo por ítem producido: none, spin:T, sleep:T, spin:exp:MEDIA,\n"
+            "      spin:uniform:MIN:MAX o spin:bimodal:A:B:P (T con ns/us/ms/s; por\n"
+            "      omisión sleep:100ms, o none con -b)\n"
+            "  -k  ítems por lote: se publican y se sacan de a K con una sola operación\n"
+            "      de semáforo y una sola toma del mutex (por omisión 1)\n"
+            "  -C  trabajo por ítem consumido, igual que -P (por omisión sleep:120ms,\n"
+            "      o none con -b)\n"
+            "  -s  pausas de espera activa antes de dormir (0: nunca girar; por omisión\n"
+            "      %d, o 0 con una sola CPU)\n",
+            prog, SPIN_LIMIT_DEFAULT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    int threads[BENCH_MAX_RUNS];
+    int num_runs = 0;
+    int verbosity = LOG_EVENT;
+    int spin = -1;
+    uint64_t seed = (uint64_t)time(NULL);
+    const char *produce_spec = NULL;
+    const char *consume_spec = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "bt:v:m:s:r:S:P:C:k:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark_mode = 1;
+            break;
+        case 't':
+            num_runs = bench_parse_list(optarg, threads, BENCH_MAX_RUNS);
+            if (num_runs == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'v':
+            verbosity = atoi(optarg);
+            break;
+        case 's':
+            spin = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'k':
+            batch_size = atoi(optarg);
+            break;
+        case 'P':
+            produce_spec = optarg;
+            break;
+        case 'C':
+            consume_spec = optarg;
+            break;
+        case 'r':
+            record_size = atoi(optarg);
+            break;
+        case 'm':
+            if (strcmp(optarg, "sem") == 0) {
+                buffer_mode = BUFFER_SEM;
+            } else if (strcmp(optarg, "mpmc") == 0) {
+                buffer_mode = BUFFER_MPMC;
+            } else if (strcmp(optarg, "spsc") == 0) {
+                buffer_mode = BUFFER_SPSC;
+            } else if (strcmp(optarg, "shard") == 0) {
+                buffer_mode = BUFFER_SHARD;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 4) {
+        usage(argv[0]);
+    }
+    const char *prog = argv[0];
+    argv += optind;
+
+    int num_producers = atoi(argv[0]);
+    int num_consumers = atoi(argv[1]);
+    buffer_size = atoi(argv[2]);
+    int items_per_producer = atoi(argv[3]);
+    if (buffer_size < 1 || batch_size < 1) {
+        usage(prog);
+    }
+    if (batch_size > buffer_size) {
+        batch_size = buffer_size; // un lote más grande nunca entra entero
+    }
+    if (!workload_parse(&produce_work, produce_spec ? produce_spec
+                                       : benchmark_mode ? "none" : "sleep:100ms") ||
+        !workload_parse(&consume_work, consume_spec ? consume_spec
+                                       : benchmark_mode ? "none" : "sleep:120ms")) {
+        usage(prog);
+    }
 
+    rng_configure(seed);
+
+    if (buffer_mode == BUFFER_SPSC) {
+        // El anillo spsc no admite más de un hilo por lado
+        int single = num_producers == 1 && num_consumers == 1;
+        for (int r = 0; r < num_runs; r++) {
+            single = single && threads[r] == 1;
+        }
+        if (!single) {
+            fprintf(stderr, "-m spsc requiere un productor y un consumidor\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (buffer_mode == BUFFER_MPMC && buffer_size < 2) {
+        // Vale también para -r: buffer_reserve()/buffer_peek() usan las
+        // mismas secuencias
+        fprintf(stderr, "-m mpmc requiere un buffer de al menos 2 lugares\n");
+        exit(EXIT_FAILURE);
+    }
+    if (buffer_mode == BUFFER_SHARD && num_producers < 1 && num_runs == 0) {
+        // Las deques son una por productor: sin productores no hay dónde
+        // repartir la capacidad (con -t siempre hay al menos uno)
+        fprintf(stderr, "-m shard requiere al menos un productor\n");
+        exit(EXIT_FAILURE);
+    }
+
+    spin_configure(spin);
+
+    if (!benchmark_mode) {
+        log_start(verbosity);
+        log_msg(LOG_INFO, "Semilla: %llu\n", (unsigned long long)seed);
+        double seconds = run_buffer(num_producers, num_consumers, items_per_producer);
+        log_msg(LOG_INFO, "Productores y consumidores terminaron en %.3f s. Fin del programa.\n",
+                seconds);
+        log_stop();
+        return 0;
+    }
+
+    if (num_runs == 0) {
+        threads[num_runs++] = -1; // una sola corrida con los valores posicionales
+    }
+    // Con -r y -k la variante lleva el tamaño del mensaje y del lote, p. ej.
+    // "mpmc-r4096" o "sem_mutex-k16"
+    char variant[48];
+    int len = snprintf(variant, sizeof variant, "%s", buffer_mode_names[buffer_mode]);
+    if (record_size > 0) {
+        len += snprintf(variant + len, sizeof variant - len, "-r%d", record_size);
+    }
+    if (batch_size > 1) {
+        snprintf(variant + len, sizeof variant - len, "-k%d", batch_size);
+    }
+    bench_csv_header();
+    for (int r = 0; r < num_runs; r++) {
+        int producers = threads[r] > 0 ? threads[r] : num_producers;
+        int consumers = threads[r] > 0 ? threads[r] : num_consumers;
+        bench_total = (long)producers * items_per_producer;
+        bench_latency = (uint64_t *)malloc(sizeof(uint64_t) * bench_total);
+        if (!bench_latency) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        double seconds = run_buffer(producers, consumers, items_per_producer);
+        bench_csv_row("producer_consumer", variant, producers, consumers,
+                      bench_total, seconds, bench_latency, bench_total);
+        free(bench_latency);
+    }
     return 0;
 }
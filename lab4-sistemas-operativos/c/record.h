@@ -0,0 +1,181 @@
+/*
+ * record.h
+ *
+ * Registros de bytes de tamaño fijo (p. ej. 64 B a 4 KB) para mover
+ * mensajes reales por el buffer de producer_consumer.c (o por cualquier
+ * cola de enteros, como la de tsqueue.c) sin un malloc por ítem. Todos los registros se reservan juntos
+ * al crear el pool; lo que viaja por el buffer o la cola es solo el índice
+ * del registro (un int), así que esas estructuras no cambian:
+ *
+ *   productor: i = record_acquire(); arma el mensaje en record_at(i);
+ *              encola i  -> el registro pasa a ser del consumidor
+ *   consumidor: desencola i; lee el mensaje en su lugar; record_release(i)
+ *
+ * El mensaje se escribe una sola vez, directamente en su lugar definitivo,
+ * y el consumidor lo lee ahí mismo: no hay copias intermedias.
+ *
+ * Como el NodePool de tsqueue.c, cada hilo toma y devuelve registros en
+ * lotes de RECORD_CACHE a través de su RecordCache, así que el lock del pool
+ * se toma una vez por lote y no por ítem. Si no queda ningún registro libre,
+ * record_acquire() espera a que un consumidor devuelva alguno: el pool
+ * también pone un límite a lo que puede haber en vuelo.
+ */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RECORD_CACHE 16  // registros por lote entre la caché de un hilo y el pool
+#define RECORD_ALIGN 64  // cada registro empieza en su propia línea de caché
+
+typedef struct {
+    int id;              // identificador que pone el productor
+    int length;          // bytes válidos en data
+    int next_free;       // enlace de la lista libre mientras no está en uso
+    unsigned char data[];
+} Record;
+
+typedef struct {
+    unsigned char *slab;       // count registros de stride bytes
+    size_t stride;
+    int count;
+    int payload;               // bytes de data por registro
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;  // hay registros libres
+    int free_list;             // -1 si no hay
+} RecordPool;
+
+// Registros libres que un hilo tiene a mano
+typedef struct {
+    int free_list;
+    int count;
+} RecordCache;
+
+// Bytes que ocupa un registro de payload bytes, redondeado a RECORD_ALIGN
+static inline size_t record_stride(int payload) {
+    return (offsetof(Record, data) + payload + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+static inline Record *record_at(const RecordPool *pool, int index) {
+    return (Record *)(pool->slab + (size_t)index * pool->stride);
+}
+
+// Crea un pool con registros de payload bytes para que haya in_flight
+// registros en el buffer o la cola mientras threads hilos guardan los suyos
+// en sus cachés
+static void record_pool_init(RecordPool *pool, int in_flight, int threads, int payload) {
+    pool->payload = payload;
+    pool->stride = record_stride(payload);
+    pool->count = in_flight + threads * 2 * RECORD_CACHE;
+    pool->slab = aligned_alloc(RECORD_ALIGN, pool->stride * pool->count);
+    if (!pool->slab) {
+        perror("aligned_alloc registros");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < pool->count; i++) {
+        record_at(pool, i)->next_free = i + 1 < pool->count ? i + 1 : -1;
+    }
+    pool->free_list = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->not_empty, NULL);
+}
+
+static void record_pool_destroy(RecordPool *pool) {
+    free(pool->slab);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->not_empty);
+}
+
+static inline void record_cache_init(RecordCache *cache) {
+    cache->free_list = -1;
+    cache->count = 0;
+}
+
+// Devuelve al pool count registros de la caché (todos si count >= los que tiene)
+static void record_cache_return(RecordPool *pool, RecordCache *cache, int count) {
+    if (cache->count == 0) {
+        return;
+    }
+    int first = cache->free_list;
+    int last = first;
+    int n = 1;
+    while (n < count && record_at(pool, last)->next_free != -1) {
+        last = record_at(pool, last)->next_free;
+        n++;
+    }
+    cache->free_list = record_at(pool, last)->next_free;
+    cache->count -= n;
+    pthread_mutex_lock(&pool->lock);
+    record_at(pool, last)->next_free = pool->free_list;
+    pool->free_list = first;
+    pthread_cond_broadcast(&pool->not_empty);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Devuelve todos los registros de la caché; llamar antes de que el hilo termine
+static inline void record_cache_flush(RecordPool *pool, RecordCache *cache) {
+    record_cache_return(pool, cache, cache->count);
+}
+
+// Toma un registro libre (esperando si no hay ninguno) y devuelve su índice.
+// Desde ahí el registro es del llamador hasta que lo encole o lo libere
+static int record_acquire(RecordPool *pool, RecordCache *cache) {
+    if (cache->free_list == -1) {
+        // Caché vacía: traer un lote del pool
+        pthread_mutex_lock(&pool->lock);
+        while (pool->free_list == -1) {
+            pthread_cond_wait(&pool->not_empty, &pool->lock);
+        }
+        int first = pool->free_list;
+        int last = first;
+        int n = 1;
+        while (n < RECORD_CACHE && record_at(pool, last)->next_free != -1) {
+            last = record_at(pool, last)->next_free;
+            n++;
+        }
+        pool->free_list = record_at(pool, last)->next_free;
+        pthread_mutex_unlock(&pool->lock);
+        record_at(pool, last)->next_free = -1;
+        cache->free_list = first;
+        cache->count = n;
+    }
+    int index = cache->free_list;
+    cache->free_list = record_at(pool, index)->next_free;
+    cache->count--;
+    return index;
+}
+
+// Libera un registro ya leído
+static void record_release(RecordPool *pool, RecordCache *cache, int index) {
+    record_at(pool, index)->next_free = cache->free_list;
+    cache->free_list = index;
+    if (++cache->count >= 2 * RECORD_CACHE) {
+        // Caché llena (típico en consumidores): devolvemos un lote al pool
+        record_cache_return(pool, cache, RECORD_CACHE);
+    }
+}
+
+// Mensaje de prueba de los demos: length bytes con el valor id & 0xff
+static inline void record_fill(Record *rec, int id, int length) {
+    rec->id = id;
+    rec->length = length;
+    memset(rec->data, id & 0xff, length);
+}
+
+// Recorre un mensaje armado con record_fill(); devuelve 0 si está corrupto
+static inline int record_check(const Record *rec) {
+    unsigned char expected = rec->id & 0xff;
+    for (int i = 0; i < rec->length; i++) {
+        if (rec->data[i] != expected) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * rng.h
+ *
+ * Generador pseudoaleatorio por hilo (xoshiro256**) para reemplazar rand()
+ * en producer_consumer.c y dining_philosophers.c. rand() comparte un único
+ * estado protegido por un lock interno de glibc, así que los hilos que
+ * generan ítems o tiempos se serializan ahí sin que se note; acá cada hilo
+ * tiene su propio estado y no comparte nada.
+ *
+ * El estado de cada hilo sale de la semilla global (-S en los programas)
+ * y del número de hilo, mezclados con splitmix64: con la misma semilla cada
+ * hilo genera siempre la misma secuencia, y hilos distintos, secuencias
+ * independientes.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} RngState;
+
+static uint64_t rng_seed;
+static __thread RngState rng_state;
+static __thread int rng_seeded;
+
+static inline uint64_t rng_splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Fija la semilla global. Llamar antes de crear los hilos
+static inline void rng_configure(uint64_t seed) {
+    rng_seed = seed;
+}
+
+// Siembra el generador del hilo que llama; stream distingue a los hilos
+// (p. ej. el id del productor o del filósofo)
+static inline void rng_thread_init(uint64_t stream) {
+    uint64_t x = rng_seed ^ rng_splitmix64(&stream);
+    for (int i = 0; i < 4; i++) {
+        rng_state.s[i] = rng_splitmix64(&x);
+    }
+    rng_seeded = 1;
+}
+
+// 64 bits pseudoaleatorios. Un hilo que no llamó a rng_thread_init() usa
+// el stream 0
+static inline uint64_t rng_next(void) {
+    if (!rng_seeded) {
+        rng_thread_init(0);
+    }
+    uint64_t *s = rng_state.s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+// Entero en [0, n), sin el sesgo de rand() % n que importe a estos tamaños
+static inline uint32_t rng_below(uint32_t n) {
+    return (uint32_t)(((rng_next() >> 32) * (uint64_t)n) >> 32);
+}
+
+// Real en [0, 1)
+static inline double rng_double(void) {
+    return (rng_next() >> 11) * 0x1.0p-53;
+}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * spinwait.h
+ *
+ * Espera adaptativa "girar y después dormir" para los puntos de bloqueo de
+ * tsqueue.c, producer_consumer.c (vía fsem.h) y dining_philosophers.c. Antes
+ * de dormir en una condición, un futex o un mutex, el hilo sondea la
+ * condición con pausas de CPU y retroceso exponencial entre sondeos
+ * (1, 2, 4, ... hasta SPIN_BACKOFF_MAX pausas).
+ *
+ * Cada punto de espera lleva un SpinTuner con su presupuesto de pausas, que
+ * se ajusta solo con lo observado:
+ *   - si la espera se resolvió girando, tiende al doble de lo que hizo falta;
+ *   - si hubo que dormir, se mide cuánto y, si girando se habría cubierto
+ *     dentro del límite, tiende al doble de eso; si no, tiende al mínimo.
+ * El ajuste es un promedio móvil (1/8 por espera), así que un caso raro no
+ * lo mueve mucho.
+ *
+ * spin_configure() fija el límite (-s en los tres programas); con -1 usa
+ * SPIN_LIMIT_DEFAULT, o 0 si hay una sola CPU, donde girar solo le quita
+ * tiempo al hilo que tiene que liberar la espera.
+ */
+
+#ifndef SPINWAIT_H
+#define SPINWAIT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define SPIN_LIMIT_DEFAULT 4096 // pausas como máximo antes de dormir
+#define SPIN_MIN 16             // presupuesto mínimo: siempre se vuelve a probar
+#define SPIN_BACKOFF_MAX 64     // pausas como máximo entre dos sondeos
+
+static int spin_limit = SPIN_LIMIT_DEFAULT;
+static double spin_relax_ns = 10.0; // duración medida de una pausa
+
+typedef struct {
+    atomic_int budget; // pausas a girar en la próxima espera
+} SpinTuner;
+
+// Pausa de CPU dentro de un bucle de espera activa
+static inline void spin_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Fija el límite de pausas (< 0: automático, 0: nunca girar) y mide cuánto
+// dura una pausa para traducir esperas en nanosegundos. Llamar antes de
+// crear los hilos
+static void spin_configure(int limit) {
+    if (limit < 0) {
+        limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT_DEFAULT : 0;
+    }
+    spin_limit = limit;
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < 10000; i++) {
+        spin_cpu_relax();
+    }
+    double ns = (bench_now_ns() - start) / 10000.0;
+    spin_relax_ns = ns > 0.1 ? ns : 0.1;
+}
+
+static inline void spin_tuner_init(SpinTuner *t) {
+    atomic_init(&t->budget, SPIN_MIN);
+}
+
+// Mueve el presupuesto 1/8 del camino hacia target (acotado a [SPIN_MIN,
+// spin_limit]). Varios hilos pueden ajustar el mismo tuner: perder alguna
+// actualización solo hace el promedio un poco más lento
+static inline void spin_adjust(SpinTuner *t, int budget, long target) {
+    if (target < SPIN_MIN) {
+        target = SPIN_MIN;
+    }
+    if (target > spin_limit) {
+        target = spin_limit;
+    }
+    atomic_store_explicit(&t->budget, budget + (int)((target - budget) / 8),
+                          memory_order_relaxed);
+}
+
+// Gira hasta que ready(arg) sea verdadero o se agote el presupuesto.
+// Devuelve 1 si la condición se cumplió; con 0 el llamador debe dormir y
+// después informar cuánto durmió con spin_parked()
+static inline int spin_wait(SpinTuner *t, int (*ready)(void *), void *arg) {
+    if (spin_limit == 0) {
+        return 0;
+    }
+    int budget = atomic_load_explicit(&t->budget, memory_order_relaxed);
+    if (budget > spin_limit) {
+        budget = spin_limit;
+    }
+    int spent = 0;
+    int backoff = 1;
+    while (spent < budget) {
+        for (int i = 0; i < backoff; i++) {
+            spin_cpu_relax();
+        }
+        spent += backoff;
+        if (ready(arg)) {
+            spin_adjust(t, budget, 2L * spent);
+            return 1;
+        }
+        if (backoff < SPIN_BACKOFF_MAX) {
+            backoff <<= 1;
+        }
+    }
+    return 0;
+}
+
+// Después de un spin_wait() fallido: el hilo durmió parked_ns. Si girando
+// un poco más se habría evitado dormir, el presupuesto crece; si no, baja
+static inline void spin_parked(SpinTuner *t, uint64_t parked_ns) {
+    if (spin_limit == 0) {
+        return;
+    }
+    int budget = atomic_load_explicit(&t->budget, memory_order_relaxed);
+    long needed = budget + (long)(parked_ns / spin_relax_ns);
+    spin_adjust(t, budget, needed <= spin_limit ? 2 * needed : SPIN_MIN);
+}
+
+static int spin_mutex_ready(void *mutex) {
+    return pthread_mutex_trylock((pthread_mutex_t *)mutex) == 0;
+}
+
+// pthread_mutex_lock con fase de espera activa: sondea con trylock y solo
+// duerme en el mutex si no se liberó dentro del presupuesto
+static inline void spin_mutex_lock(SpinTuner *t, pthread_mutex_t *mutex) {
+    if (pthread_mutex_trylock(mutex) == 0 || spin_wait(t, spin_mutex_ready, mutex)) {
+        return;
+    }
+    uint64_t parked = bench_now_ns();
+    pthread_mutex_lock(mutex);
+    spin_parked(t, bench_now_ns() - parked);
+}
+
+#endif
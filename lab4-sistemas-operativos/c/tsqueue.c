@@ -5,45 +5,1116 @@
  * Múltiples hilos productores y consumidores pueden encolar y desencolar
  * sin condiciones de carrera. Si la cola está vacía, los consumidores esperan.
  *
- * Compilar: gcc tsqueue.c -o tsqueue -pthread
- * Uso: ./tsqueue <num_producers> <num_consumers> <items_per_producer>
+ * Con -DQUEUE_LOCKFREE se compila en cambio una cola lock-free de Michael y
+ * Scott (CAS sobre head/tail, hazard pointers para liberar nodos) con la
+ * misma API queue_init/enqueue/dequeue. Con -DQUEUE_TWO_LOCK se usa la
+ * variante de dos locks (uno para head y otro para tail) con nodo centinela.
+ * En las variantes enlazadas los nodos salen de un pool propio de la cola con
+ * cachés por hilo, así que encolar/desencolar no llama a malloc/free.
+ * Con -DQUEUE_RING la cola es un buffer circular acotado y contiguo
+ * (capacidad QUEUE_RING_CAPACITY, potencia de dos) donde los productores
+ * esperan en not_full cuando está lleno.
+ *
+ * Compilar: gcc tsqueue.c -o tsqueue -pthread -lm
+ *           gcc -DQUEUE_LOCKFREE tsqueue.c -o tsqueue -pthread -lm
+ *           gcc -DQUEUE_TWO_LOCK tsqueue.c -o tsqueue -pthread -lm
+ *           gcc -DQUEUE_RING [-DQUEUE_RING_CAPACITY=1024] tsqueue.c -o tsqueue -pthread -lm
+ * Uso: ./tsqueue [-b] [-t hilos,...] [-v nivel] [-s pausas] [-S semilla] [-P carga] [-C carga] <num_producers> <num_consumers> <items_per_producer> [batch_size]
+ *
+ * -b activa el modo benchmark: sin log ni demoras, imprime en CSV (ver
+ * bench.h) ops/s y los percentiles p50/p99/p999 de la latencia entre encolar
+ * y desencolar; -t 1,2,4,8 repite la corrida con esas cantidades de
+ * productores y consumidores. Los campos de cada lado de la cola van en
+ * líneas de caché separadas; compilando con -DQUEUE_NO_PADDING se obtiene el
+ * layout compacto para comparar, p. ej. ./tsqueue -b 8 8 200000 con y sin
+ * esa opción. Los mensajes por item pasan por el log asíncrono de log.h;
+ * -v 0|1|2 elige el nivel (2, un mensaje por item, es el valor por omisión).
+ *
+ * -P y -C describen el trabajo de cada ráfaga producida y de cada lote
+ * consumido con el modelo de carga de workload.h (p. ej. "spin:2us"); por
+ * omisión el demo duerme 100 ms y 150 ms y el benchmark no demora nada.
+ * -S fija la semilla de las distribuciones aleatorias.
+ *
+ * enqueue_batch()/dequeue_batch() mueven varios items por cada toma del lock;
+ * con batch_size > 1 los productores encolan en ráfagas de ese tamaño.
+ * try_dequeue() no bloquea y dequeue_timeout() espera como máximo un plazo
+ * medido con CLOCK_MONOTONIC, para sondear varias colas sin quedarse dormido.
+ * queue_close() marca el fin del flujo: despierta a todos los que esperan y
+ * dequeue() devuelve QUEUE_CLOSED una vez que la cola quedó vacía.
+ * Antes de dormir en una condición, consumidores (y en el buffer circular
+ * también productores) giran un poco según spinwait.h, con un presupuesto
+ * que se ajusta solo a lo que tardan las esperas; -s fija su máximo.
  */
 
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "bench.h"
+#include "log.h"
+#include "spinwait.h"
+#include "workload.h"
+
+// Los campos que escribe cada lado (consumidores en head, productores en
+// tail) van en líneas de caché separadas para evitar false sharing. Con
+// -DQUEUE_NO_PADDING se compila el layout compacto, para comparar con -b.
+#define CACHE_LINE 64
+#ifdef QUEUE_NO_PADDING
+#define CACHE_ALIGNED
+#define CACHE_LINE_LAYOUT "-nopad"
+#else
+#define CACHE_ALIGNED _Alignas(CACHE_LINE)
+#define CACHE_LINE_LAYOUT ""
+#endif
+
+// Resultado de enqueue(), dequeue(), try_dequeue() y dequeue_timeout()
+enum {
+    QUEUE_OK = 0,
+    QUEUE_EMPTY,    // try_dequeue: no había elementos
+    QUEUE_TIMEOUT,  // dequeue_timeout: venció el plazo sin elementos
+    QUEUE_CLOSED,   // la cola se cerró (y, al desencolar, ya está vacía)
+};
+
+// Las condiciones usan CLOCK_MONOTONIC para que los plazos no dependan de
+// cambios en el reloj del sistema
+static void queue_cond_init(pthread_cond_t *cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Calcula el instante absoluto timeout_ns a partir de ahora
+static void queue_deadline(struct timespec *deadline, long long timeout_ns) {
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ns / 1000000000LL;
+    deadline->tv_nsec += timeout_ns % 1000000000LL;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+// Espera en cond; sin deadline espera indefinidamente. Devuelve ETIMEDOUT
+// si venció el plazo
+static int queue_wait(pthread_cond_t *cond, pthread_mutex_t *lock,
+                      const struct timespec *deadline) {
+    if (deadline == NULL) {
+        return pthread_cond_wait(cond, lock);
+    }
+    return pthread_cond_timedwait(cond, lock, deadline);
+}
+
+#if !defined(QUEUE_LOCKFREE) && !defined(QUEUE_TWO_LOCK)
+// Fase de espera activa antes de dormir en una condición (spinwait.h):
+// suelta lock, gira mientras ready(q) sea falso y lo vuelve a tomar.
+// Devuelve 0 si la condición se cumplió girando; si no, el instante desde
+// el que el hilo va a dormir, para informarlo después con spin_parked()
+static uint64_t queue_spin_unlocked(SpinTuner *spin, pthread_mutex_t *lock,
+                                    int (*ready)(void *), void *q) {
+    pthread_mutex_unlock(lock);
+    int ok = spin_wait(spin, ready, q);
+    pthread_mutex_lock(lock);
+    return ok ? 0 : bench_now_ns();
+}
+#endif
+
+#ifndef QUEUE_RING
+#if defined(QUEUE_LOCKFREE) || defined(QUEUE_TWO_LOCK)
+typedef struct Node {
+    int value;
+    _Atomic(struct Node *) next;  // se lee fuera del lock que lo escribe
+} Node;
+#define node_next(n) atomic_load(&(n)->next)
+#define node_set_next(n, v) atomic_init(&(n)->next, (v))
+#else
 typedef struct Node {
     int value;
     struct Node *next;
 } Node;
+#define node_next(n) ((n)->next)
+#define node_set_next(n, v) ((n)->next = (v))
+#endif
+
+/*
+ * Pool de nodos de la cola.
+ *
+ * Los nodos se reservan en bloques de POOL_CHUNK_NODES y se reciclan en
+ * vez de llamar a malloc/free en cada operación. Cada hilo guarda una caché
+ * local de nodos libres y solo toca el lock del pool para mover lotes de
+ * POOL_CACHE_NODES, así que en régimen estable no hay llamadas al heap.
+ * Al terminar un hilo su caché vuelve al pool, así que los hilos que van y
+ * vienen tampoco hacen crecer la cantidad de bloques.
+ */
+
+#define POOL_CHUNK_NODES 256   // nodos por bloque pedido a malloc
+#define POOL_CACHE_NODES 64    // tamaño de los lotes entre caché y pool
+
+typedef union PoolSlot {
+    Node node;
+    union PoolSlot *next_free;
+} PoolSlot;
+
+typedef struct PoolChunk {
+    struct PoolChunk *next;
+    PoolSlot slots[POOL_CHUNK_NODES];
+} PoolChunk;
+
+typedef struct NodePool {
+    CACHE_ALIGNED pthread_mutex_t lock;
+    PoolSlot *free_list;         // lotes devueltos por las cachés
+    PoolChunk *chunks;           // todos los bloques, se liberan al destruir
+    unsigned long id;            // distingue un pool nuevo de uno ya destruido
+    struct NodePool *next_live;
+} NodePool;
+
+// Pools vivos; solo se consulta cuando un hilo cambia de cola o termina
+static pthread_mutex_t pool_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static NodePool *pool_registry;
+static unsigned long pool_next_id;
+
+// Caché del hilo; pertenece a un solo pool a la vez
+static __thread struct {
+    NodePool *owner;
+    unsigned long owner_id;
+    PoolSlot *free_list;
+    int count;
+} node_cache;
+static pthread_key_t node_cache_key;
+static pthread_once_t node_cache_once = PTHREAD_ONCE_INIT;
+
+static void pool_init(NodePool *pool) {
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free_list = NULL;
+    pool->chunks = NULL;
+    pthread_mutex_lock(&pool_registry_lock);
+    pool->id = ++pool_next_id;
+    pool->next_live = pool_registry;
+    pool_registry = pool;
+    pthread_mutex_unlock(&pool_registry_lock);
+}
+
+static void pool_destroy(NodePool *pool) {
+    pthread_mutex_lock(&pool_registry_lock);
+    for (NodePool **p = &pool_registry; *p != NULL; p = &(*p)->next_live) {
+        if (*p == pool) {
+            *p = pool->next_live;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_registry_lock);
+
+    while (pool->chunks != NULL) {
+        PoolChunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+    pthread_mutex_destroy(&pool->lock);
+}
+
+// Devuelve una lista de nodos (first..last) al pool
+static void pool_put_list(NodePool *pool, PoolSlot *first, PoolSlot *last) {
+    pthread_mutex_lock(&pool->lock);
+    last->next_free = pool->free_list;
+    pool->free_list = first;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Vacía la caché del hilo: si el pool dueño sigue vivo le devuelve los
+// nodos; si ya fue destruido simplemente se olvidan
+static void node_cache_drop(void) {
+    if (node_cache.free_list != NULL) {
+        // Los nodos viven en los bloques del pool dueño: solo se recorren si
+        // sigue vivo. El lock del registro impide que lo destruyan mientras
+        pthread_mutex_lock(&pool_registry_lock);
+        for (NodePool *p = pool_registry; p != NULL; p = p->next_live) {
+            if (p == node_cache.owner && p->id == node_cache.owner_id) {
+                PoolSlot *last = node_cache.free_list;
+                while (last->next_free != NULL) {
+                    last = last->next_free;
+                }
+                pool_put_list(p, node_cache.free_list, last);
+                break;
+            }
+        }
+        pthread_mutex_unlock(&pool_registry_lock);
+    }
+    node_cache.owner = NULL;
+    node_cache.free_list = NULL;
+    node_cache.count = 0;
+}
+
+// Destructor de la clave: cuando un hilo termina, sus nodos en caché vuelven
+// al pool en vez de quedar varados hasta queue_destroy()
+static void node_cache_exit(void *cache) {
+    (void)cache;
+    node_cache_drop();
+}
+
+static void node_cache_key_create(void) {
+    pthread_key_create(&node_cache_key, node_cache_exit);
+}
+
+// Asocia la caché del hilo al pool, devolviendo antes los nodos que tuviera
+// de otro
+static void node_cache_bind(NodePool *pool) {
+    if (node_cache.owner == pool && node_cache.owner_id == pool->id) {
+        return;
+    }
+    node_cache_drop();
+    node_cache.owner = pool;
+    node_cache.owner_id = pool->id;
+    // Cualquier valor no nulo: solo hace falta que el destructor se ejecute
+    pthread_once(&node_cache_once, node_cache_key_create);
+    pthread_setspecific(node_cache_key, pool);
+}
+
+// Llena la caché con un lote del pool o, si está vacío, con un bloque nuevo
+static void pool_refill(NodePool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->free_list != NULL) {
+        PoolSlot *first = pool->free_list;
+        PoolSlot *last = first;
+        int n = 1;
+        while (n < POOL_CACHE_NODES && last->next_free != NULL) {
+            last = last->next_free;
+            n++;
+        }
+        pool->free_list = last->next_free;
+        last->next_free = NULL;
+        node_cache.free_list = first;
+        node_cache.count = n;
+    } else {
+        PoolChunk *chunk = (PoolChunk *)malloc(sizeof(PoolChunk));
+        if (!chunk) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        for (int i = 0; i < POOL_CHUNK_NODES - 1; i++) {
+            chunk->slots[i].next_free = &chunk->slots[i + 1];
+        }
+        chunk->slots[POOL_CHUNK_NODES - 1].next_free = NULL;
+        node_cache.free_list = &chunk->slots[0];
+        node_cache.count = POOL_CHUNK_NODES;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static Node *node_alloc(NodePool *pool) {
+    node_cache_bind(pool);
+    if (node_cache.free_list == NULL) {
+        pool_refill(pool);
+    }
+    PoolSlot *slot = node_cache.free_list;
+    node_cache.free_list = slot->next_free;
+    node_cache.count--;
+    return &slot->node;
+}
+
+static void node_free(NodePool *pool, Node *node) {
+    node_cache_bind(pool);
+    PoolSlot *slot = (PoolSlot *)node;
+    slot->next_free = node_cache.free_list;
+    node_cache.free_list = slot;
+    if (++node_cache.count >= 2 * POOL_CACHE_NODES) {
+        // Caché llena (típico en consumidores): devolvemos un lote al pool
+        PoolSlot *last = slot;
+        for (int i = 1; i < POOL_CACHE_NODES; i++) {
+            last = last->next_free;
+        }
+        node_cache.free_list = last->next_free;
+        node_cache.count -= POOL_CACHE_NODES;
+        pool_put_list(pool, slot, last);
+    }
+}
+
+// Arma fuera de cualquier lock una cadena con los n items; devuelve el
+// primer nodo y deja en *last el último
+static Node *node_chain(NodePool *pool, const int *items, int n, Node **last) {
+    Node *first = NULL;
+    Node *prev = NULL;
+    for (int i = 0; i < n; i++) {
+        Node *node = node_alloc(pool);
+        node->value = items[i];
+        node_set_next(node, NULL);
+        if (prev == NULL) {
+            first = node;
+        } else {
+            node_set_next(prev, node);
+        }
+        prev = node;
+    }
+    *last = prev;
+    return first;
+}
+
+#ifndef QUEUE_LOCKFREE
+// Devuelve al pool los nodos desde first hasta stop (sin incluirlo)
+static void node_free_chain(NodePool *pool, Node *first, Node *stop) {
+    while (first != stop) {
+        Node *next = node_next(first);
+        node_free(pool, first);
+        first = next;
+    }
+}
+#endif
+#endif /* !QUEUE_RING */
+
+#if defined(QUEUE_RING)
+/*
+ * Variante de buffer circular acotado. Los items viven en un arreglo
+ * contiguo reservado una sola vez; head y tail son contadores que solo
+ * crecen y se enmascaran con capacity - 1 en vez de seguir punteros.
+ */
+
+#ifndef QUEUE_RING_CAPACITY
+#define QUEUE_RING_CAPACITY 1024
+#endif
+_Static_assert((QUEUE_RING_CAPACITY & (QUEUE_RING_CAPACITY - 1)) == 0,
+               "QUEUE_RING_CAPACITY debe ser potencia de dos");
+
+#define QUEUE_VARIANT "ring"
 
 typedef struct {
+    int *items;                   // solo lectura después de queue_init
+    unsigned mask;
+    // Con un solo lock ambos lados tocan todo el estado: va junto, aparte
+    CACHE_ALIGNED pthread_mutex_t lock;
+    unsigned head;                // próximo a desencolar
+    unsigned tail;                // próximo a encolar
+    int closed;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    SpinTuner spin_empty;         // consumidores antes de dormir en not_empty
+    SpinTuner spin_full;          // productores antes de dormir en not_full
+} ThreadSafeQueue;
+
+// Inicializa la cola
+void queue_init(ThreadSafeQueue *q) {
+    q->items = (int *)malloc(sizeof(int) * QUEUE_RING_CAPACITY);
+    if (!q->items) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    q->mask = QUEUE_RING_CAPACITY - 1;
+    q->head = q->tail = 0;
+    q->closed = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    queue_cond_init(&q->not_empty);
+    queue_cond_init(&q->not_full);
+    spin_tuner_init(&q->spin_empty);
+    spin_tuner_init(&q->spin_full);
+}
+
+// Sondeos de la fase de espera activa: sin el lock tomado, solo miran el
+// estado si lo consiguen con trylock
+static int queue_ready_items(void *arg) {
+    ThreadSafeQueue *q = arg;
+    if (pthread_mutex_trylock(&q->lock) != 0) {
+        return 0;
+    }
+    int ready = q->tail != q->head || q->closed;
+    pthread_mutex_unlock(&q->lock);
+    return ready;
+}
+
+static int queue_ready_space(void *arg) {
+    ThreadSafeQueue *q = arg;
+    if (pthread_mutex_trylock(&q->lock) != 0) {
+        return 0;
+    }
+    int ready = q->tail - q->head < QUEUE_RING_CAPACITY || q->closed;
+    pthread_mutex_unlock(&q->lock);
+    return ready;
+}
+
+// Espera en not_full hasta que haya lugar o se cierre la cola, girando
+// primero; se llama y vuelve con el lock tomado
+static void queue_wait_space(ThreadSafeQueue *q) {
+    uint64_t parked = queue_spin_unlocked(&q->spin_full, &q->lock, queue_ready_space, q);
+    while (q->tail - q->head == QUEUE_RING_CAPACITY && !q->closed) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    if (parked) {
+        spin_parked(&q->spin_full, bench_now_ns() - parked);
+    }
+}
+
+// Libera el buffer; ningún hilo debe estar usando la cola
+void queue_destroy(ThreadSafeQueue *q) {
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+// Cierra la cola: despierta a todos los que esperan; los consumidores
+// reciben QUEUE_CLOSED cuando ya no quedan elementos
+void queue_close(ThreadSafeQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Encola un elemento al final; si está llena, espera. QUEUE_CLOSED si la
+// cola se cerró
+int enqueue(ThreadSafeQueue *q, int item) {
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == QUEUE_RING_CAPACITY && !q->closed) {
+        queue_wait_space(q);
+    }
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return QUEUE_CLOSED;
+    }
+    q->items[q->tail & q->mask] = item;
+    q->tail++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return QUEUE_OK;
+}
+
+// Encola n elementos copiando tantos como quepan por cada toma del lock.
+// Devuelve cuántos encoló (menos de n si la cola se cerró mientras esperaba)
+int enqueue_batch(ThreadSafeQueue *q, const int *items, int n) {
+    int done = 0;
+    pthread_mutex_lock(&q->lock);
+    while (done < n) {
+        if (q->tail - q->head == QUEUE_RING_CAPACITY && !q->closed) {
+            queue_wait_space(q);
+        }
+        if (q->closed) {
+            break;
+        }
+        unsigned space = QUEUE_RING_CAPACITY - (q->tail - q->head);
+        while (space > 0 && done < n) {
+            q->items[q->tail & q->mask] = items[done++];
+            q->tail++;
+            space--;
+        }
+        pthread_cond_broadcast(&q->not_empty);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return done;
+}
+
+// Desencola hasta max elementos en una sola sección crítica. Con la cola
+// vacía espera según timeout_ns (< 0: sin límite, 0: no espera); devuelve
+// cuántos obtuvo, 0 si venció el plazo y -1 si está cerrada y vacía
+static int queue_take(ThreadSafeQueue *q, int *out, int max, long long timeout_ns) {
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        queue_deadline(&deadline, timeout_ns);
+    }
+    pthread_mutex_lock(&q->lock);
+    int spun = 0;
+    uint64_t parked = 0;
+    while (q->tail == q->head) {
+        if (q->closed) {
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        }
+        if (timeout_ns != 0 && !spun) {
+            // Antes de dormir, girar una vez sin el lock
+            spun = 1;
+            parked = queue_spin_unlocked(&q->spin_empty, &q->lock, queue_ready_items, q);
+            continue;
+        }
+        if (timeout_ns == 0 ||
+            queue_wait(&q->not_empty, &q->lock, timeout_ns > 0 ? &deadline : NULL) == ETIMEDOUT) {
+            if (q->tail == q->head) {
+                int closed = q->closed;
+                pthread_mutex_unlock(&q->lock);
+                return closed ? -1 : 0;
+            }
+        }
+    }
+    if (parked) {
+        spin_parked(&q->spin_empty, bench_now_ns() - parked);
+    }
+    int n = 0;
+    while (n < max && q->head != q->tail) {
+        out[n++] = q->items[q->head & q->mask];
+        q->head++;
+    }
+    if (n == 1) {
+        pthread_cond_signal(&q->not_full);
+    } else {
+        pthread_cond_broadcast(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return n;
+}
+
+#elif defined(QUEUE_LOCKFREE)
+/*
+ * Variante lock-free (cola de Michael y Scott).
+ *
+ * head y tail se actualizan con CAS; la lista siempre tiene un nodo
+ * centinela al frente. Un nodo desencolado no se libera de inmediato:
+ * se "retira" y solo se libera cuando ningún hilo lo tiene publicado en
+ * un hazard pointer, así evitamos accesos a memoria liberada y el problema ABA.
+ */
+
+#define HP_RECORDS 64                       // hilos operando a la vez sobre la cola
+#define HP_PER_RECORD 2                     // hazard pointers por operación
+#define HP_TOTAL (HP_RECORDS * HP_PER_RECORD)
+#define HP_RETIRE_THRESHOLD (2 * HP_TOTAL)  // nodos retirados antes de escanear
+
+// Registro de hazard pointers. Se reserva por operación (no por hilo), así
+// que no hay que registrar ni liberar hilos; la lista de retirados pasa al
+// siguiente que reserve el registro.
+typedef struct {
+    _Alignas(CACHE_LINE) atomic_int in_use;
+    _Atomic(Node *) hp[HP_PER_RECORD];
+    int retired_count;
+    Node *retired[HP_RETIRE_THRESHOLD];
+} HazardRecord;
+
+#define QUEUE_VARIANT "lockfree"
+
+typedef struct {
+    CACHE_ALIGNED _Atomic(Node *) head;   // CAS de consumidores
+    CACHE_ALIGNED _Atomic(Node *) tail;   // CAS de productores
+    // Se leen en cada operación y casi nunca se escriben
+    CACHE_ALIGNED HazardRecord *records;
+    atomic_int closed;
+    atomic_int waiters;
+    // Solo se usan cuando un consumidor encuentra la cola vacía
+    CACHE_ALIGNED pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    SpinTuner spin;               // consumidores antes de dormir en not_empty
+    NodePool pool;
+} ThreadSafeQueue;
+
+// Último registro usado por este hilo, para no competir siempre por el primero
+static __thread unsigned hp_hint;
+
+static HazardRecord *hp_acquire(ThreadSafeQueue *q) {
+    for (unsigned i = hp_hint;; i++) {
+        HazardRecord *rec = &q->records[i % HP_RECORDS];
+        int expected = 0;
+        if (atomic_load_explicit(&rec->in_use, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&rec->in_use, &expected, 1)) {
+            hp_hint = i % HP_RECORDS;
+            return rec;
+        }
+        if (i - hp_hint >= HP_RECORDS) {
+            // Todos ocupados: más hilos que registros, cedemos la CPU
+            sched_yield();
+        }
+    }
+}
+
+static void hp_release(HazardRecord *rec) {
+    for (int i = 0; i < HP_PER_RECORD; i++) {
+        atomic_store_explicit(&rec->hp[i], NULL, memory_order_release);
+    }
+    atomic_store_explicit(&rec->in_use, 0, memory_order_release);
+}
+
+// Publica el puntero leído de src en el hazard pointer i y verifica que
+// siga vigente; desde ahí el nodo no puede liberarse.
+static Node *hp_protect(HazardRecord *rec, int i, _Atomic(Node *) *src) {
+    Node *p = atomic_load(src);
+    for (;;) {
+        atomic_store(&rec->hp[i], p);
+        Node *again = atomic_load(src);
+        if (again == p) {
+            return p;
+        }
+        p = again;
+    }
+}
+
+static int compare_ptr(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(Node *const *)a;
+    uintptr_t y = (uintptr_t)*(Node *const *)b;
+    return (x > y) - (x < y);
+}
+
+// Libera los nodos retirados que ningún hilo tiene protegidos
+static void hp_scan(ThreadSafeQueue *q, HazardRecord *rec) {
+    Node *hazards[HP_TOTAL];
+    int n = 0;
+    for (int r = 0; r < HP_RECORDS; r++) {
+        for (int i = 0; i < HP_PER_RECORD; i++) {
+            Node *p = atomic_load(&q->records[r].hp[i]);
+            if (p != NULL) {
+                hazards[n++] = p;
+            }
+        }
+    }
+    qsort(hazards, n, sizeof(Node *), compare_ptr);
+
+    int kept = 0;
+    for (int i = 0; i < rec->retired_count; i++) {
+        Node *node = rec->retired[i];
+        if (bsearch(&node, hazards, n, sizeof(Node *), compare_ptr)) {
+            rec->retired[kept++] = node;
+        } else {
+            node_free(&q->pool, node);
+        }
+    }
+    rec->retired_count = kept;
+}
+
+static void hp_retire(ThreadSafeQueue *q, HazardRecord *rec, Node *node) {
+    rec->retired[rec->retired_count++] = node;
+    if (rec->retired_count == HP_RETIRE_THRESHOLD) {
+        hp_scan(q, rec);
+    }
+}
+
+// Inicializa la cola
+void queue_init(ThreadSafeQueue *q) {
+    pool_init(&q->pool);
+    Node *dummy = node_alloc(&q->pool);
+    q->records = (HazardRecord *)aligned_alloc(CACHE_LINE, sizeof(HazardRecord) * HP_RECORDS);
+    if (!q->records) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(q->records, 0, sizeof(HazardRecord) * HP_RECORDS);
+    atomic_init(&dummy->next, NULL);
+    atomic_init(&q->head, dummy);
+    atomic_init(&q->tail, dummy);
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->waiters, 0);
+    pthread_mutex_init(&q->lock, NULL);
+    queue_cond_init(&q->not_empty);
+    spin_tuner_init(&q->spin);
+}
+
+// Libera nodos y registros; ningún hilo debe estar usando la cola.
+// Los nodos (en la lista o retirados) viven en los bloques del pool.
+void queue_destroy(ThreadSafeQueue *q) {
+    pool_destroy(&q->pool);
+    free(q->records);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+// Enlaza la cadena first..last al final con un solo CAS exitoso
+static void queue_push_chain(ThreadSafeQueue *q, Node *first, Node *last, int n) {
+    HazardRecord *rec = hp_acquire(q);
+    for (;;) {
+        Node *tail = hp_protect(rec, 0, &q->tail);
+        Node *next = atomic_load(&tail->next);
+        if (next != NULL) {
+            // tail quedó atrasado: ayudamos a avanzarlo
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        Node *expected = NULL;
+        if (atomic_compare_exchange_strong(&tail->next, &expected, first)) {
+            atomic_compare_exchange_strong(&q->tail, &tail, last);
+            break;
+        }
+    }
+    hp_release(rec);
+
+    // Despertamos consumidores solo si alguno está dormido
+    if (atomic_load(&q->waiters) > 0) {
+        pthread_mutex_lock(&q->lock);
+        if (n == 1) {
+            pthread_cond_signal(&q->not_empty);
+        } else {
+            pthread_cond_broadcast(&q->not_empty);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+// Cierra la cola: despierta a todos los consumidores dormidos; reciben
+// QUEUE_CLOSED cuando ya no quedan elementos. Sin locks no se puede frenar
+// un enqueue() que ya pasó el chequeo, así que hay que cerrar cuando los
+// productores terminaron
+void queue_close(ThreadSafeQueue *q) {
+    atomic_store(&q->closed, 1);
+    pthread_mutex_lock(&q->lock);
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Encola un elemento al final; QUEUE_CLOSED si la cola se cerró
+int enqueue(ThreadSafeQueue *q, int item) {
+    if (atomic_load(&q->closed)) {
+        return QUEUE_CLOSED;
+    }
+    Node *new_node = node_alloc(&q->pool);
+    new_node->value = item;
+    atomic_init(&new_node->next, NULL);
+    queue_push_chain(q, new_node, new_node, 1);
+    return QUEUE_OK;
+}
+
+// Encola n elementos como una sola cadena; devuelve cuántos encoló
+int enqueue_batch(ThreadSafeQueue *q, const int *items, int n) {
+    if (n <= 0 || atomic_load(&q->closed)) {
+        return 0;
+    }
+    Node *last;
+    Node *first = node_chain(&q->pool, items, n, &last);
+    queue_push_chain(q, first, last, n);
+    return n;
+}
+
+// Intenta desencolar hasta max elementos sin bloquear moviendo head una sola
+// vez; devuelve cuántos obtuvo (0 si la cola está vacía)
+static int queue_pop_batch(ThreadSafeQueue *q, int *out, int max) {
+    HazardRecord *rec = hp_acquire(q);
+    for (;;) {
+        Node *head = hp_protect(rec, 0, &q->head);
+        Node *tail = atomic_load(&q->tail);
+        Node *next = atomic_load(&head->next);
+        if (head != atomic_load(&q->head)) {
+            continue;
+        }
+        if (next == NULL) {
+            hp_release(rec);
+            return 0;
+        }
+        if (head == tail) {
+            atomic_compare_exchange_strong(&q->tail, &tail, next);
+            continue;
+        }
+        // Recorremos mano a mano: cada nodo se publica en hp[1] y se valida
+        // que head no cambió, así ninguno puede liberarse mientras lo leemos.
+        // Nunca pasamos de tail para que tail no quede detrás de head.
+        Node *last = head;
+        int n = 0;
+        while (n < max) {
+            Node *node = atomic_load(&last->next);
+            if (node == NULL) {
+                break;
+            }
+            atomic_store(&rec->hp[1], node);
+            if (atomic_load(&q->head) != head) {
+                break;
+            }
+            out[n++] = node->value;
+            last = node;
+            if (node == tail) {
+                break;
+            }
+        }
+        if (n > 0 && atomic_compare_exchange_strong(&q->head, &head, last)) {
+            // last pasa a ser el nuevo centinela; los anteriores se retiran
+            atomic_store(&rec->hp[0], NULL);
+            atomic_store(&rec->hp[1], NULL);
+            while (head != last) {
+                Node *following = atomic_load(&head->next);
+                hp_retire(q, rec, head);
+                head = following;
+            }
+            hp_release(rec);
+            return n;
+        }
+    }
+}
+
+// Como queue_pop_batch(), pero devuelve -1 si la cola está cerrada y vacía.
+// closed se lee antes de mirar la cola: lo encolado antes de cerrar ya es visible
+static int queue_pop_open(ThreadSafeQueue *q, int *out, int max) {
+    int closed = atomic_load(&q->closed);
+    int n = queue_pop_batch(q, out, max);
+    return (n == 0 && closed) ? -1 : n;
+}
+
+// Intento de desencolar de la fase de espera activa
+typedef struct {
+    ThreadSafeQueue *q;
+    int *out;
+    int max;
+    int n;
+} QueuePopAttempt;
+
+static int queue_pop_ready(void *arg) {
+    QueuePopAttempt *attempt = arg;
+    attempt->n = queue_pop_open(attempt->q, attempt->out, attempt->max);
+    return attempt->n != 0;
+}
+
+// Desencola hasta max elementos. Con la cola vacía espera según timeout_ns
+// (< 0: sin límite, 0: no espera), girando antes de dormir; devuelve
+// cuántos obtuvo, 0 si venció el plazo y -1 si está cerrada y vacía
+static int queue_take(ThreadSafeQueue *q, int *out, int max, long long timeout_ns) {
+    int n = queue_pop_open(q, out, max);
+    if (n != 0 || timeout_ns == 0) {
+        return n;
+    }
+    QueuePopAttempt attempt = {q, out, max, 0};
+    if (spin_wait(&q->spin, queue_pop_ready, &attempt)) {
+        return attempt.n;
+    }
+    uint64_t parked = bench_now_ns();
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        queue_deadline(&deadline, timeout_ns);
+    }
+    pthread_mutex_lock(&q->lock);
+    // Anunciamos la espera antes de volver a mirar la cola; enqueue()
+    // publica el nodo antes de leer waiters, así que no se pierde la señal
+    atomic_fetch_add(&q->waiters, 1);
+    while ((n = queue_pop_open(q, out, max)) == 0) {
+        if (queue_wait(&q->not_empty, &q->lock, timeout_ns > 0 ? &deadline : NULL) == ETIMEDOUT) {
+            n = queue_pop_open(q, out, max);
+            break;
+        }
+    }
+    atomic_fetch_sub(&q->waiters, 1);
+    pthread_mutex_unlock(&q->lock);
+    spin_parked(&q->spin, bench_now_ns() - parked);
+    return n;
+}
+
+#elif defined(QUEUE_TWO_LOCK)
+/*
+ * Variante con dos locks (Michael y Scott): head_lock para consumidores y
+ * tail_lock para productores. Un nodo centinela al frente garantiza que
+ * nunca tocan el mismo nodo, así que encolar y desencolar avanzan a la vez.
+ */
+
+#define QUEUE_VARIANT "twolock"
+
+typedef struct {
+    // Lado de los consumidores
+    CACHE_ALIGNED pthread_mutex_t head_lock;
+    Node *head;                   // centinela; protegido por head_lock
+    pthread_cond_t not_empty;     // se usa con head_lock
+    SpinTuner spin;               // consumidores antes de dormir en not_empty
+    // Lado de los productores
+    CACHE_ALIGNED pthread_mutex_t tail_lock;
+    Node *tail;                   // protegido por tail_lock
+    // Los productores leen waiters en cada enqueue
+    CACHE_ALIGNED atomic_int closed;  // se escribe con tail_lock
+    atomic_int waiters;           // consumidores dormidos en not_empty
+    NodePool pool;
+} ThreadSafeQueue;
+
+// Inicializa la cola
+void queue_init(ThreadSafeQueue *q) {
+    pool_init(&q->pool);
+    Node *dummy = node_alloc(&q->pool);
+    atomic_init(&dummy->next, NULL);
+    q->head = q->tail = dummy;
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->waiters, 0);
+    pthread_mutex_init(&q->head_lock, NULL);
+    pthread_mutex_init(&q->tail_lock, NULL);
+    queue_cond_init(&q->not_empty);
+    spin_tuner_init(&q->spin);
+}
+
+// Sondeo de la fase de espera activa; se llama con head_lock tomado, que
+// no frena a los productores
+static int queue_ready(void *arg) {
+    ThreadSafeQueue *q = arg;
+    return atomic_load(&q->head->next) != NULL || atomic_load(&q->closed);
+}
+
+// Libera los nodos pendientes; ningún hilo debe estar usando la cola
+void queue_destroy(ThreadSafeQueue *q) {
+    pool_destroy(&q->pool);
+    pthread_mutex_destroy(&q->head_lock);
+    pthread_mutex_destroy(&q->tail_lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+// Cierra la cola: despierta a todos los consumidores dormidos; reciben
+// QUEUE_CLOSED cuando ya no quedan elementos
+void queue_close(ThreadSafeQueue *q) {
+    // Con tail_lock ningún enqueue() queda a medias después de cerrar
+    pthread_mutex_lock(&q->tail_lock);
+    atomic_store(&q->closed, 1);
+    pthread_mutex_unlock(&q->tail_lock);
+
+    pthread_mutex_lock(&q->head_lock);
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->head_lock);
+}
+
+// Encola un elemento al final; QUEUE_CLOSED si la cola se cerró
+int enqueue(ThreadSafeQueue *q, int item) {
+    Node *new_node = node_alloc(&q->pool);
+    new_node->value = item;
+    atomic_init(&new_node->next, NULL);
+
+    pthread_mutex_lock(&q->tail_lock);
+    if (atomic_load(&q->closed)) {
+        pthread_mutex_unlock(&q->tail_lock);
+        node_free(&q->pool, new_node);
+        return QUEUE_CLOSED;
+    }
+    atomic_store(&q->tail->next, new_node);
+    q->tail = new_node;
+    pthread_mutex_unlock(&q->tail_lock);
+
+    // Solo tomamos head_lock si hay consumidores esperando
+    if (atomic_load(&q->waiters) > 0) {
+        pthread_mutex_lock(&q->head_lock);
+        pthread_cond_signal(&q->not_empty);
+        pthread_mutex_unlock(&q->head_lock);
+    }
+    return QUEUE_OK;
+}
+
+// Encola n elementos tomando tail_lock una sola vez; devuelve cuántos encoló
+int enqueue_batch(ThreadSafeQueue *q, const int *items, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+    Node *last;
+    Node *first = node_chain(&q->pool, items, n, &last);
+
+    pthread_mutex_lock(&q->tail_lock);
+    if (atomic_load(&q->closed)) {
+        pthread_mutex_unlock(&q->tail_lock);
+        node_free_chain(&q->pool, first, NULL);
+        return 0;
+    }
+    atomic_store(&q->tail->next, first);
+    q->tail = last;
+    pthread_mutex_unlock(&q->tail_lock);
+
+    if (atomic_load(&q->waiters) > 0) {
+        pthread_mutex_lock(&q->head_lock);
+        pthread_cond_broadcast(&q->not_empty);
+        pthread_mutex_unlock(&q->head_lock);
+    }
+    return n;
+}
+
+// Desencola hasta max elementos en una sola sección crítica. Con la cola
+// vacía espera según timeout_ns (< 0: sin límite, 0: no espera); devuelve
+// cuántos obtuvo, 0 si venció el plazo y -1 si está cerrada y vacía
+static int queue_take(ThreadSafeQueue *q, int *out, int max, long long timeout_ns) {
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        queue_deadline(&deadline, timeout_ns);
+    }
+    pthread_mutex_lock(&q->head_lock);
+    // closed se lee antes que head->next: lo encolado antes de cerrar ya es visible
+    int closed = atomic_load(&q->closed);
+    Node *next = atomic_load(&q->head->next);
+    if (next == NULL && !closed && timeout_ns != 0 && spin_wait(&q->spin, queue_ready, q)) {
+        closed = atomic_load(&q->closed);
+        next = atomic_load(&q->head->next);
+    }
+    if (next == NULL && !closed && timeout_ns != 0) {
+        uint64_t parked = bench_now_ns();
+        // Anunciamos la espera antes de volver a mirar; enqueue() enlaza el
+        // nodo antes de leer waiters, así que no se pierde la señal
+        atomic_fetch_add(&q->waiters, 1);
+        for (;;) {
+            closed = atomic_load(&q->closed);
+            if ((next = atomic_load(&q->head->next)) != NULL || closed) {
+                break;
+            }
+            if (queue_wait(&q->not_empty, &q->head_lock,
+                           timeout_ns > 0 ? &deadline : NULL) == ETIMEDOUT) {
+                closed = atomic_load(&q->closed);
+                next = atomic_load(&q->head->next);
+                break;
+            }
+        }
+        atomic_fetch_sub(&q->waiters, 1);
+        spin_parked(&q->spin, bench_now_ns() - parked);
+    }
+    if (next == NULL) {
+        pthread_mutex_unlock(&q->head_lock);
+        return closed ? -1 : 0;
+    }
+    // El último nodo tomado pasa a ser el nuevo centinela
+    Node *to_free = q->head;
+    int n = 0;
+    do {
+        out[n++] = next->value;
+        q->head = next;
+    } while (n < max && (next = atomic_load(&next->next)) != NULL);
+    Node *stop = q->head;
+    pthread_mutex_unlock(&q->head_lock);
+    node_free_chain(&q->pool, to_free, stop);
+    return n;
+}
+
+#else
+#define QUEUE_VARIANT "mutex"
+
+typedef struct {
+    // Con un solo lock ambos lados tocan todo el estado: va junto, aparte
+    CACHE_ALIGNED pthread_mutex_t lock;
     Node *head;
     Node *tail;
-    pthread_mutex_t lock;
+    int closed;
     pthread_cond_t not_empty;
+    SpinTuner spin;               // consumidores antes de dormir en not_empty
+    NodePool pool;
 } ThreadSafeQueue;
 
 // Inicializa la cola
 void queue_init(ThreadSafeQueue *q) {
     q->head = q->tail = NULL;
+    q->closed = 0;
+    pool_init(&q->pool);
     pthread_mutex_init(&q->lock, NULL);
-    pthread_cond_init(&q->not_empty, NULL);
+    queue_cond_init(&q->not_empty);
+    spin_tuner_init(&q->spin);
 }
 
-// Encola un elemento al final
-void enqueue(ThreadSafeQueue *q, int item) {
-    Node *new_node = (Node *)malloc(sizeof(Node));
-    if (!new_node) {
-        perror("malloc");
-        exit(EXIT_FAILURE);
+// Sondeo de la fase de espera activa: sin el lock tomado, solo mira la
+// cola si lo consigue con trylock
+static int queue_ready(void *arg) {
+    ThreadSafeQueue *q = arg;
+    if (pthread_mutex_trylock(&q->lock) != 0) {
+        return 0;
     }
+    int ready = q->head != NULL || q->closed;
+    pthread_mutex_unlock(&q->lock);
+    return ready;
+}
+
+// Libera los nodos pendientes; ningún hilo debe estar usando la cola
+void queue_destroy(ThreadSafeQueue *q) {
+    pool_destroy(&q->pool);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+}
+
+// Cierra la cola: despierta a todos los consumidores dormidos; reciben
+// QUEUE_CLOSED cuando ya no quedan elementos
+void queue_close(ThreadSafeQueue *q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Encola un elemento al final; QUEUE_CLOSED si la cola se cerró
+int enqueue(ThreadSafeQueue *q, int item) {
+    Node *new_node = node_alloc(&q->pool);
     new_node->value = item;
     new_node->next = NULL;
 
     pthread_mutex_lock(&q->lock);
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        node_free(&q->pool, new_node);
+        return QUEUE_CLOSED;
+    }
     if (q->tail == NULL) {
         // Si está vacía, head y tail apuntan al mismo nodo
         q->head = q->tail = new_node;
@@ -54,90 +1125,205 @@ void enqueue(ThreadSafeQueue *q, int item) {
     // Señalizamos a cualquier consumidor que esté esperando
     pthread_cond_signal(&q->not_empty);
     pthread_mutex_unlock(&q->lock);
+    return QUEUE_OK;
+}
+
+// Encola n elementos tomando el lock una sola vez; devuelve cuántos encoló
+int enqueue_batch(ThreadSafeQueue *q, const int *items, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+    Node *last;
+    Node *first = node_chain(&q->pool, items, n, &last);
+
+    pthread_mutex_lock(&q->lock);
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        node_free_chain(&q->pool, first, NULL);
+        return 0;
+    }
+    if (q->tail == NULL) {
+        q->head = first;
+    } else {
+        q->tail->next = first;
+    }
+    q->tail = last;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return n;
 }
 
-// Desencola un elemento; si está vacía, espera
-int dequeue(ThreadSafeQueue *q) {
+// Desencola hasta max elementos en una sola sección crítica. Con la cola
+// vacía espera según timeout_ns (< 0: sin límite, 0: no espera); devuelve
+// cuántos obtuvo, 0 si venció el plazo y -1 si está cerrada y vacía
+static int queue_take(ThreadSafeQueue *q, int *out, int max, long long timeout_ns) {
+    struct timespec deadline;
+    if (timeout_ns > 0) {
+        queue_deadline(&deadline, timeout_ns);
+    }
     pthread_mutex_lock(&q->lock);
+    int spun = 0;
+    uint64_t parked = 0;
     while (q->head == NULL) {
-        // Esperar hasta que no esté vacía
-        pthread_cond_wait(&q->not_empty, &q->lock);
+        if (q->closed) {
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        }
+        if (timeout_ns != 0 && !spun) {
+            // Antes de dormir, girar una vez sin el lock
+            spun = 1;
+            parked = queue_spin_unlocked(&q->spin, &q->lock, queue_ready, q);
+            continue;
+        }
+        // Esperar hasta que no esté vacía, se cierre o venza el plazo
+        if (timeout_ns == 0 ||
+            queue_wait(&q->not_empty, &q->lock, timeout_ns > 0 ? &deadline : NULL) == ETIMEDOUT) {
+            if (q->head == NULL) {
+                int closed = q->closed;
+                pthread_mutex_unlock(&q->lock);
+                return closed ? -1 : 0;
+            }
+        }
+    }
+    if (parked) {
+        spin_parked(&q->spin, bench_now_ns() - parked);
+    }
+    Node *first = q->head;
+    int n = 0;
+    while (n < max && q->head != NULL) {
+        out[n++] = q->head->value;
+        q->head = q->head->next;
     }
-    Node *to_free = q->head;
-    int result = to_free->value;
-    q->head = q->head->next;
     if (q->head == NULL) {
         // Si quedó vacía, tail también a NULL
         q->tail = NULL;
     }
-    free(to_free);
+    Node *stop = q->head;
     pthread_mutex_unlock(&q->lock);
-    return result;
+    node_free_chain(&q->pool, first, stop);
+    return n;
+}
+
+#endif
+
+// Desencola un elemento en *out; si está vacía, espera. QUEUE_CLOSED indica
+// fin de flujo: la cola se cerró y no quedan elementos
+int dequeue(ThreadSafeQueue *q, int *out) {
+    return queue_take(q, out, 1, -1) > 0 ? QUEUE_OK : QUEUE_CLOSED;
+}
+
+// Desencola hasta max elementos de una vez; si está vacía, espera al menos
+// uno. Devuelve 0 cuando la cola se cerró y no quedan elementos
+int dequeue_batch(ThreadSafeQueue *q, int *out, int max) {
+    int n = queue_take(q, out, max, -1);
+    return n > 0 ? n : 0;
+}
+
+// Desencola sin bloquear: QUEUE_EMPTY si no hay elementos
+int try_dequeue(ThreadSafeQueue *q, int *out) {
+    int n = queue_take(q, out, 1, 0);
+    return n > 0 ? QUEUE_OK : n == 0 ? QUEUE_EMPTY : QUEUE_CLOSED;
 }
 
+// Desencola esperando como máximo timeout_ns nanosegundos (CLOCK_MONOTONIC):
+// QUEUE_TIMEOUT si vence el plazo sin elementos
+int dequeue_timeout(ThreadSafeQueue *q, int *out, long long timeout_ns) {
+    int n = queue_take(q, out, 1, timeout_ns);
+    return n > 0 ? QUEUE_OK : n == 0 ? QUEUE_TIMEOUT : QUEUE_CLOSED;
+}
+
+// Modo benchmark (-b): sin log ni demoras; cada item es un índice en
+// bench_latency, donde el productor anota cuándo lo encoló y el consumidor
+// lo reemplaza por la latencia encolar→desencolar
+static int benchmark_mode = 0;
+static uint64_t *bench_latency;
+
+// Trabajo simulado por ráfaga producida y por lote consumido (-P y -C)
+static Workload produce_work;
+static Workload consume_work;
+
 // Variables globales para pasar parámetros a hilos
 typedef struct {
     ThreadSafeQueue *queue;
     int producer_id;
     int items_to_produce;
+    int batch_size;  // items por ráfaga (enqueue_batch)
 } ProducerArgs;
 
 typedef struct {
     ThreadSafeQueue *queue;
     int consumer_id;
-    int total_items; // solo para saber cuándo detenerse
-    int *consumed_count; // contador compartido
-    pthread_mutex_t *count_lock;
+    int batch_size;  // máximo de items por dequeue_batch
 } ConsumerArgs;
 
-// Función de productor: encola items_to_produce elementos
+// Función de productor: encola items_to_produce elementos en ráfagas
 void *producer_thread(void *arg) {
     ProducerArgs *args = (ProducerArgs *)arg;
-    for (int i = 0; i < args->items_to_produce; i++) {
-        int item = args->producer_id * 1000 + i; // valor único según productor e índice
-        printf("[Producer %d] Enqueuing item %d\n", args->producer_id, item);
-        enqueue(args->queue, item);
-        // Opcional: dormir un poco para simular trabajo
-        usleep(100000); // 100 ms
+    // En el heap: el tamaño de la ráfaga sale de la línea de comandos
+    int *burst = malloc(sizeof(int) * args->batch_size);
+    if (!burst) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
     }
+    rng_thread_init(args->producer_id);
+    for (int i = 0; i < args->items_to_produce; i += args->batch_size) {
+        int n = 0;
+        while (n < args->batch_size && i + n < args->items_to_produce) {
+            if (benchmark_mode) {
+                burst[n] = args->producer_id * args->items_to_produce + i + n;
+                bench_latency[burst[n]] = bench_now_ns();
+            } else {
+                burst[n] = args->producer_id * 1000 + i + n; // valor único según productor e índice
+                log_msg(LOG_EVENT, "[Producer %d] Enqueuing item %d\n", args->producer_id, burst[n]);
+            }
+            n++;
+        }
+        if (n == 1) {
+            enqueue(args->queue, burst[0]);
+        } else {
+            enqueue_batch(args->queue, burst, n);
+        }
+        // Simular el trabajo de producir la ráfaga siguiente
+        workload_run(&produce_work);
+    }
+    free(burst);
     return NULL;
 }
 
-// Función de consumidor: desencola hasta que se consuman total_items
+// Función de consumidor: desencola hasta que la cola se cierre y se vacíe
 void *consumer_thread(void *arg) {
     ConsumerArgs *args = (ConsumerArgs *)arg;
-    while (1) {
-        // Chequear si ya consumimos todos los items esperados
-        pthread_mutex_lock(args->count_lock);
-        if (*(args->consumed_count) >= args->total_items) {
-            pthread_mutex_unlock(args->count_lock);
-            break;
+    int *items = malloc(sizeof(int) * args->batch_size);
+    if (!items) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int local_count = 0;
+    int n;
+    rng_thread_init(0x100000000ULL + args->consumer_id); // aparte de los productores
+    while ((n = dequeue_batch(args->queue, items, args->batch_size)) > 0) {
+        if (benchmark_mode) {
+            uint64_t now = bench_now_ns();
+            for (int i = 0; i < n; i++) {
+                bench_latency[items[i]] = now - bench_latency[items[i]];
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                log_msg(LOG_EVENT, "[Consumer %d] Dequeued item %d (consumido #%d)\n",
+                        args->consumer_id, items[i], ++local_count);
+            }
         }
-        pthread_mutex_unlock(args->count_lock);
-
-        int item = dequeue(args->queue);
-        pthread_mutex_lock(args->count_lock);
-        (*(args->consumed_count))++;
-        int local_count = *(args->consumed_count);
-        pthread_mutex_unlock(args->count_lock);
-
-        printf("[Consumer %d] Dequeued item %d (consumido #%d)\n",
-               args->consumer_id, item, local_count);
         // Simular consumo
-        usleep(150000); // 150 ms
+        workload_run(&consume_work);
     }
+    free(items);
     return NULL;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Uso: %s <num_producers> <num_consumers> <items_per_producer>\n", argv[0]);
-        exit(EXIT_FAILURE);
-    }
-    int num_producers = atoi(argv[1]);
-    int num_consumers = atoi(argv[2]);
-    int items_per_producer = atoi(argv[3]);
-
+// Lanza productores y consumidores sobre una cola nueva y espera a que
+// terminen; devuelve los segundos transcurridos
+static double run_queue(int num_producers, int num_consumers,
+                        int items_per_producer, int batch_size) {
     ThreadSafeQueue queue;
     queue_init(&queue);
 
@@ -147,17 +1333,14 @@ int main(int argc, char *argv[]) {
     ProducerArgs pargs[num_producers];
     ConsumerArgs cargs[num_consumers];
 
-    // Contador total de elementos que deben consumirse
-    int total_items = num_producers * items_per_producer;
-    int consumed_count = 0;
-    pthread_mutex_t count_lock;
-    pthread_mutex_init(&count_lock, NULL);
+    uint64_t start = bench_now_ns();
 
     // Crear hilos productores
     for (int i = 0; i < num_producers; i++) {
         pargs[i].queue = &queue;
         pargs[i].producer_id = i;
         pargs[i].items_to_produce = items_per_producer;
+        pargs[i].batch_size = batch_size;
         if (pthread_create(&producers[i], NULL, producer_thread, &pargs[i]) != 0) {
             perror("pthread_create productor");
             exit(EXIT_FAILURE);
@@ -168,9 +1351,7 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < num_consumers; i++) {
         cargs[i].queue = &queue;
         cargs[i].consumer_id = i;
-        cargs[i].total_items = total_items;
-        cargs[i].consumed_count = &consumed_count;
-        cargs[i].count_lock = &count_lock;
+        cargs[i].batch_size = batch_size;
         if (pthread_create(&consumers[i], NULL, consumer_thread, &cargs[i]) != 0) {
             perror("pthread_create consumidor");
             exit(EXIT_FAILURE);
@@ -181,20 +1362,126 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < num_producers; i++) {
         pthread_join(producers[i], NULL);
     }
-    // Después de que todos los productores terminaron, es posible que
-    // queden consumidores esperando. Despertarlos para que chequeen el conteo.
-    pthread_cond_broadcast(&queue.not_empty);
+    // Ya no habrá más elementos: cerrar la cola despierta a los consumidores
+    // dormidos y cada uno termina en cuanto la encuentra vacía
+    queue_close(&queue);
 
     // Esperar a consumidores
     for (int i = 0; i < num_consumers; i++) {
         pthread_join(consumers[i], NULL);
     }
+    double seconds = (bench_now_ns() - start) / 1e9;
 
-    // Destruir mutexes y cond
-    pthread_mutex_destroy(&queue.lock);
-    pthread_cond_destroy(&queue.not_empty);
-    pthread_mutex_destroy(&count_lock);
+    // Destruir cola, mutexes y cond
+    queue_destroy(&queue);
+    return seconds;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-b] [-t hilos,...] [-v nivel] [-s pausas] [-S semilla] [-P carga] [-C carga] <num_producers> <num_consumers> <items_per_producer> [batch_size]\n"
+            "  -b  modo benchmark: sin log ni demoras, imprime CSV con ops/s y latencias\n"
+            "  -t  (con -b) repite la corrida con esa cantidad de productores y de consumidores\n"
+            "  -v  nivel de log: 0 nada, 1 resumen, 2 un mensaje por item (por omisión)\n"
+            "  -S  semilla de las demoras aleatorias (por omisión, la hora)\n"
+            "  -P  trabajo por ráfaga producida: none, spin:T, sleep:T, spin:exp:MEDIA,\n"
+            "      spin:uniform:MIN:MAX o spin:bimodal:A:B:P (T con ns/us/ms/s; por\n"
+            "      omisión sleep:100ms, o none con -b)\n"
+            "  -C  trabajo por lote consumido, igual que -P (por omisión sleep:150ms,\n"
+            "      o none con -b)\n"
+            "  -s  pausas de espera activa antes de dormir (0: nunca girar; por omisión\n"
+            "      %d, o 0 con una sola CPU)\n",
+            prog, SPIN_LIMIT_DEFAULT);
+    exit(EXIT_FAILURE);
+}
 
-    printf("Todos los productores y consumidores han finalizado.\n");
+int main(int argc, char *argv[]) {
+    int threads[BENCH_MAX_RUNS];
+    int num_runs = 0;
+    int verbosity = LOG_EVENT;
+    int spin = -1;
+    uint64_t seed = (uint64_t)time(NULL);
+    const char *produce_spec = NULL;
+    const char *consume_spec = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "bt:v:s:S:P:C:")) != -1) {
+        switch (opt) {
+        case 'b':
+            benchmark_mode = 1;
+            break;
+        case 't':
+            num_runs = bench_parse_list(optarg, threads, BENCH_MAX_RUNS);
+            if (num_runs == 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'v':
+            verbosity = atoi(optarg);
+            break;
+        case 's':
+            spin = atoi(optarg);
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'P':
+            produce_spec = optarg;
+            break;
+        case 'C':
+            consume_spec = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    int nargs = argc - optind;
+    if (nargs != 3 && nargs != 4) {
+        usage(argv[0]);
+    }
+    const char *prog = argv[0];
+    argv += optind;
+    int num_producers = atoi(argv[0]);
+    int num_consumers = atoi(argv[1]);
+    int items_per_producer = atoi(argv[2]);
+    int batch_size = nargs == 4 ? atoi(argv[3]) : 1;
+    if (batch_size < 1) {
+        batch_size = 1;
+    }
+    if (!workload_parse(&produce_work, produce_spec ? produce_spec
+                                       : benchmark_mode ? "none" : "sleep:100ms") ||
+        !workload_parse(&consume_work, consume_spec ? consume_spec
+                                       : benchmark_mode ? "none" : "sleep:150ms")) {
+        usage(prog);
+    }
+    rng_configure(seed);
+
+    spin_configure(spin);
+
+    if (!benchmark_mode) {
+        log_start(verbosity);
+        run_queue(num_producers, num_consumers, items_per_producer, batch_size);
+        log_msg(LOG_INFO, "Todos los productores y consumidores han finalizado.\n");
+        log_stop();
+        return 0;
+    }
+
+    if (num_runs == 0) {
+        threads[num_runs++] = -1; // una sola corrida con los valores posicionales
+    }
+    bench_csv_header();
+    for (int r = 0; r < num_runs; r++) {
+        int producers = threads[r] > 0 ? threads[r] : num_producers;
+        int consumers = threads[r] > 0 ? threads[r] : num_consumers;
+        long total = (long)producers * items_per_producer;
+        bench_latency = (uint64_t *)malloc(sizeof(uint64_t) * total);
+        if (!bench_latency) {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+        double seconds = run_queue(producers, consumers, items_per_producer, batch_size);
+        bench_csv_row("tsqueue", QUEUE_VARIANT CACHE_LINE_LAYOUT, producers, consumers,
+                      total, seconds, bench_latency, total);
+        free(bench_latency);
+    }
     return 0;
 }
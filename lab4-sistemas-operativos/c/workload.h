@@ -0,0 +1,158 @@
+/*
+ * workload.h
+ *
+ * Modelo de carga para simular el trabajo de producir, consumir, pensar o
+ * comer en los tres programas, en lugar de usleep() fijos. Se describe con
+ * una cadena:
+ *
+ *   none                         sin demora
+ *   spin:T                       T de CPU ocupada (espera activa sobre el reloj)
+ *   sleep:T                      T durmiendo
+ *   spin:exp:MEDIA               exponencial con esa media
+ *   spin:uniform:MIN:MAX         uniforme entre MIN y MAX
+ *   spin:bimodal:A:B:P           B con probabilidad P, si no A
+ *
+ * (las distribuciones también valen con sleep:). Los tiempos aceptan los
+ * sufijos ns, us, ms y s; sin sufijo son nanosegundos. Por ejemplo
+ * "spin:bimodal:2us:200us:0.01" modela un servicio de 2 us con un 1% de
+ * casos lentos.
+ *
+ * Con spin el hilo ocupa la CPU como lo haría un servicio real, así que
+ * las esperas del benchmark miden la sincronización bajo carga y no la
+ * duración de un usleep(). Los valores aleatorios salen de rng.h.
+ *
+ * La exponencial usa log(), por eso los programas se enlazan con -lm.
+ */
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "rng.h"
+
+typedef enum { WORK_NONE, WORK_SPIN, WORK_SLEEP } WorkKind;
+typedef enum { WORK_FIXED, WORK_EXP, WORK_UNIFORM, WORK_BIMODAL } WorkDist;
+
+typedef struct {
+    WorkKind kind;
+    WorkDist dist;
+    double a, b; // duración fija, media, MIN/MAX o A/B, en ns
+    double p;    // probabilidad de B en bimodal
+} Workload;
+
+// Lee una duración con sufijo opcional (ns, us, ms, s) hasta ':' o el final;
+// devuelve el puntero al resto o NULL si no es válida
+static const char *workload_parse_time(const char *s, double *ns) {
+    char *end;
+    double value = strtod(s, &end);
+    if (end == s || value < 0) {
+        return NULL;
+    }
+    double scale = 1;
+    if (strncmp(end, "ns", 2) == 0) {
+        end += 2;
+    } else if (strncmp(end, "us", 2) == 0) {
+        scale = 1e3;
+        end += 2;
+    } else if (strncmp(end, "ms", 2) == 0) {
+        scale = 1e6;
+        end += 2;
+    } else if (*end == 's') {
+        scale = 1e9;
+        end++;
+    }
+    if (*end != ':' && *end != '\0') {
+        return NULL;
+    }
+    *ns = value * scale;
+    return end;
+}
+
+// Lee el siguiente campo ":T"; NULL si falta o no es válido
+static const char *workload_next_time(const char *s, double *ns) {
+    return s && *s == ':' ? workload_parse_time(s + 1, ns) : NULL;
+}
+
+// Interpreta spec; devuelve 0 si no es válida
+static int workload_parse(Workload *w, const char *spec) {
+    memset(w, 0, sizeof *w);
+    if (strcmp(spec, "none") == 0) {
+        w->kind = WORK_NONE;
+        return 1;
+    }
+    const char *s;
+    if (strncmp(spec, "spin:", 5) == 0) {
+        w->kind = WORK_SPIN;
+        s = spec + 5;
+    } else if (strncmp(spec, "sleep:", 6) == 0) {
+        w->kind = WORK_SLEEP;
+        s = spec + 6;
+    } else {
+        return 0;
+    }
+    if (strncmp(s, "exp:", 4) == 0) {
+        w->dist = WORK_EXP;
+        s = workload_parse_time(s + 4, &w->a);
+    } else if (strncmp(s, "uniform:", 8) == 0) {
+        w->dist = WORK_UNIFORM;
+        s = workload_next_time(workload_parse_time(s + 8, &w->a), &w->b);
+        if (s && w->b < w->a) {
+            return 0;
+        }
+    } else if (strncmp(s, "bimodal:", 8) == 0) {
+        w->dist = WORK_BIMODAL;
+        s = workload_next_time(workload_parse_time(s + 8, &w->a), &w->b);
+        if (s && *s == ':') {
+            char *end;
+            w->p = strtod(s + 1, &end);
+            s = end != s + 1 && w->p >= 0 && w->p <= 1 ? end : NULL;
+        } else {
+            s = NULL;
+        }
+    } else {
+        w->dist = WORK_FIXED;
+        s = workload_parse_time(s, &w->a);
+    }
+    return s != NULL && *s == '\0';
+}
+
+// Duración de la próxima unidad de trabajo, en ns
+static inline uint64_t workload_sample(const Workload *w) {
+    switch (w->dist) {
+    case WORK_EXP:
+        return (uint64_t)(-w->a * log(1.0 - rng_double()));
+    case WORK_UNIFORM:
+        return (uint64_t)(w->a + (w->b - w->a) * rng_double());
+    case WORK_BIMODAL:
+        return (uint64_t)(rng_double() < w->p ? w->b : w->a);
+    default:
+        return (uint64_t)w->a;
+    }
+}
+
+// Simula una unidad de trabajo según w
+static inline void workload_run(const Workload *w) {
+    if (w->kind == WORK_NONE) {
+        return;
+    }
+    uint64_t ns = workload_sample(w);
+    if (w->kind == WORK_SLEEP) {
+        struct timespec ts = {(time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL)};
+        while (nanosleep(&ts, &ts) != 0) {
+            // interrumpido por una señal: dormir lo que falta
+        }
+        return;
+    }
+    uint64_t end = bench_now_ns() + ns;
+    while (bench_now_ns() < end) {
+        // CPU ocupada, como un servicio real
+    }
+}
+
+#endif